@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Helpers of the vppinfra benchmarks (bench_*.c): timing of a step and
+ * the "<name> <value>" command line options */
+
+#ifndef __included_latency_bench_h__
+#define __included_latency_bench_h__
+
+#include <vppinfra/format.h>
+#include <vppinfra/time.h>
+
+typedef struct {
+  u64 clocks;
+  f64 seconds;
+} bench_timer_t;
+
+static void bench_start (bench_timer_t * t) {
+  t->seconds = unix_time_now ();
+  t->clocks = clib_cpu_time_now ();
+}
+
+static void bench_stop (bench_timer_t * t, char * step, u32 n_ops) {
+  u64 clocks = clib_cpu_time_now () - t->clocks;
+  f64 seconds = unix_time_now () - t->seconds;
+
+  fformat (stdout, "%s: %u ops, %.1f clocks/op, %.1f ns/op, %.0f ops/s\n",
+           step, n_ops, (f64) clocks / n_ops, seconds * 1e9 / n_ops,
+           n_ops / seconds);
+}
+
+/* Option "<name> <n>" if value is set, "<name> <size>" (e.g. 512m)
+ * otherwise. Arrays of options end with a zero entry */
+typedef struct {
+  char * name;
+  u32 * value;
+  uword * size;
+} bench_arg_t;
+
+/* Parse the command line into args, returns 0 on success */
+static int bench_parse_args (char * argv[], bench_arg_t * args) {
+  unformat_input_t input;
+  bench_arg_t * a;
+  int rv = 0;
+
+  unformat_init_command_line (&input, argv);
+  while (!rv && unformat_check_input (&input) != UNFORMAT_END_OF_INPUT) {
+    for (a = args; a->name; a++) {
+      if (unformat (&input, a->name)) {
+        break;
+      }
+    }
+    if (!a->name) {
+      fformat (stderr, "unknown input '%U'\n", format_unformat_error,
+               &input);
+      rv = 1;
+    } else if (a->value ? !unformat (&input, "%u", a->value)
+               : !unformat (&input, "%U", unformat_memory_size, a->size)) {
+      fformat (stderr, "%s: bad value '%U'\n", a->name,
+               format_unformat_error, &input);
+      rv = 1;
+    }
+  }
+  unformat_free (&input);
+  return rv;
+}
+
+#endif /* __included_latency_bench_h__ */
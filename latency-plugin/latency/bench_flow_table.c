@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ *------------------------------------------------------------------
+ * bench_flow_table.c - flow key and flow table benchmark
+ *
+ * bench_flow_table [flows <n>] [buckets <n>] [memory <size>]
+ *                  [heap <size>] [seed <n>]
+ *
+ * Times the steps of the flow table of one thread with the plugin code
+ * (make_key of key.c) and the same bihash_24_8 as the plugin:
+ * - make_key for n flows (one client IPv4 address and a pseudo random port
+ *   per flow, one server)
+ * - insert of all keys
+ * - lookup of all keys in random order (hits)
+ * - lookup of as many keys of unknown flows (misses)
+ * Prints clocks and nanoseconds per operation and operations per second
+ * of each step. The default is 1M flows with one bucket per 4 flows, like
+ * the plugin defaults; for 10M flows pass e.g.
+ * "flows 10000000 memory 2g heap 4g".
+ *
+ * Then counts the distinct flows which share their key with another flow,
+ * for the old key (XOR of the endpoints) and the canonical key of
+ * make_key, on the same n random flows of two traffic mixes:
+ * - random: random addresses and ports
+ * - servers: clients of a /16 with random ports towards 16 servers of a
+ *   /24 on port 443
+ *------------------------------------------------------------------
+ */
+
+#include <vnet/vnet.h>
+#include <latency/latency.h>
+
+#include <vppinfra/bihash_template.c>
+#include <vppinfra/random.h>
+#include <latency/bench.h>
+
+/* make_key reads the MB IP, 0 here */
+latency_main_t latency_main;
+
+#define CLIENT_IP 0x0b000000    /* 11.0.0.0 and up, one per flow */
+#define SERVER_IP 0x0a000001    /* 10.0.0.1 */
+#define SERVER_PORT 4433
+
+/* Client packet of flow i, with a pseudo random client port */
+static u8 bench_key (latency_key_t * key, u32 i, u16 server_port) {
+  return make_key (key, CLIENT_IP + i, SERVER_IP,
+                   1024 + (i * 2654435761U) % 64512, server_port,
+                   IP_PROTOCOL_UDP);
+}
+
+/* Flow with the lo endpoint first, both directions are the same flow */
+typedef struct {
+  u32 ip[2];
+  u16 port[2];
+} bench_flow_t;
+
+/* Key before the canonical key: the XOR of the endpoints, both directions
+ * of a flow give the same key, but so do many distinct flows */
+static u64 bench_xor_key (bench_flow_t * f) {
+  return (u64) (f->ip[0] ^ f->ip[1])
+    | (u64) (f->port[0] ^ f->port[1]) << 32
+    | (u64) IP_PROTOCOL_UDP << 48;
+}
+
+static int bench_flow_cmp (const void * a, const void * b) {
+  return memcmp (a, b, sizeof (bench_flow_t));
+}
+
+static int bench_key_cmp (const void * a, const void * b) {
+  return memcmp (a, b, sizeof (latency_key_t));
+}
+
+static int bench_u64_cmp (const void * a, const void * b) {
+  u64 x = *(u64 *) a, y = *(u64 *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Number of elements of the sorted array v which are equal to a neighbour */
+static u32 bench_n_shared (u8 * v, u32 n, u32 size) {
+  u32 i, n_shared = 0;
+
+  for (i = 0; i < n; i++) {
+    if ((i > 0 && !memcmp (v + i * size, v + (i - 1) * size, size))
+        || (i + 1 < n && !memcmp (v + i * size, v + (i + 1) * size, size))) {
+      n_shared++;
+    }
+  }
+  return n_shared;
+}
+
+/* Random u16, the low bits of random_u32 (an LCG) have short periods */
+static u16 bench_random_u16 (u32 * seed) {
+  return random_u32 (seed) >> 16;
+}
+
+/* n random distinct flows, see the mixes above */
+static u32 bench_random_flows (bench_flow_t * flows, u32 n, int servers,
+                               u32 * seed) {
+  u32 i, j, ip[2];
+  u16 port[2];
+
+  for (i = 0; i < n; i++) {
+    if (servers) {
+      ip[0] = 0x0a000000 | bench_random_u16 (seed);
+      ip[1] = 0x0a010000 | (bench_random_u16 (seed) >> 12);
+      port[0] = 1024 + bench_random_u16 (seed) % 64512;
+      port[1] = 443;
+    } else {
+      /* Not 0, make_key would take it for the MB IP */
+      ip[0] = (bench_random_u16 (seed) << 16 | bench_random_u16 (seed)) | 1;
+      ip[1] = (bench_random_u16 (seed) << 16 | bench_random_u16 (seed)) | 1;
+      port[0] = bench_random_u16 (seed);
+      port[1] = bench_random_u16 (seed);
+    }
+    j = ip[0] > ip[1] || (ip[0] == ip[1] && port[0] > port[1]);
+    memset (&flows[i], 0, sizeof (flows[i]));
+    flows[i].ip[0] = ip[j];
+    flows[i].ip[1] = ip[!j];
+    flows[i].port[0] = port[j];
+    flows[i].port[1] = port[!j];
+  }
+
+  /* Drop the flows drawn twice */
+  qsort (flows, n, sizeof (flows[0]), bench_flow_cmp);
+  for (i = j = 0; i < n; i++) {
+    if (!i || bench_flow_cmp (&flows[i], &flows[j - 1])) {
+      flows[j++] = flows[i];
+    }
+  }
+  return j;
+}
+
+static void bench_collisions (u32 n_flows, int servers, u32 seed) {
+  bench_flow_t * flows = 0;
+  latency_key_t * keys = 0;
+  u64 * xor_keys = 0;
+  u32 i, n, n_xor, n_canonical;
+
+  vec_validate (flows, n_flows - 1);
+  vec_validate (keys, n_flows - 1);
+  vec_validate (xor_keys, n_flows - 1);
+
+  n = bench_random_flows (flows, n_flows, servers, &seed);
+  for (i = 0; i < n; i++) {
+    xor_keys[i] = bench_xor_key (&flows[i]);
+    make_key (&keys[i], flows[i].ip[0], flows[i].ip[1], flows[i].port[0],
+              flows[i].port[1], IP_PROTOCOL_UDP);
+  }
+  qsort (xor_keys, n, sizeof (xor_keys[0]), bench_u64_cmp);
+  qsort (keys, n, sizeof (keys[0]), bench_key_cmp);
+  n_xor = bench_n_shared ((u8 *) xor_keys, n, sizeof (xor_keys[0]));
+  n_canonical = bench_n_shared ((u8 *) keys, n, sizeof (keys[0]));
+
+  fformat (stdout, "%s: %u flows, sharing their key: xor %u (%.3f%%), "
+           "canonical %u (%.3f%%)\n", servers ? "servers" : "random", n,
+           n_xor, 100.0 * n_xor / n, n_canonical, 100.0 * n_canonical / n);
+
+  vec_free (flows);
+  vec_free (keys);
+  vec_free (xor_keys);
+}
+
+int main (int argc, char * argv[]) {
+  BVT (clib_bihash) table;
+  BVT (clib_bihash_kv) kv, kv_return;
+  latency_key_t * keys = 0;
+  u32 * order = 0;
+  u8 * src_lo = 0;
+  u32 n_flows = 1 << 20, n_buckets = 0, seed = 0xdeadbeef;
+  uword memory = 512ULL << 20, heap = 2ULL << 30;
+  bench_timer_t t;
+  u32 i, j, tmp, n_found = 0;
+
+  bench_arg_t args[] = {
+    { "flows", &n_flows },
+    { "buckets", &n_buckets },
+    { "memory", 0, &memory },
+    { "heap", 0, &heap },
+    { "seed", &seed },
+    { 0 },
+  };
+
+  if (bench_parse_args (argv, args)) {
+    return 1;
+  }
+
+  clib_mem_init (0, heap);
+
+  if (!n_buckets) {
+    n_buckets = max_pow2 (clib_max (n_flows / 4, 1));
+  }
+  fformat (stdout, "%u flows, %u buckets, %U table memory\n", n_flows,
+           n_buckets, format_memory_size, memory);
+
+  vec_validate_aligned (keys, n_flows - 1, CLIB_CACHE_LINE_BYTES);
+  vec_validate (src_lo, n_flows - 1);
+  vec_validate (order, n_flows - 1);
+
+  /* Random lookup order, Fisher-Yates */
+  for (i = 0; i < n_flows; i++) {
+    order[i] = i;
+  }
+  for (i = n_flows - 1; i > 0; i--) {
+    j = random_u32 (&seed) % (i + 1);
+    tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  bench_start (&t);
+  for (i = 0; i < n_flows; i++) {
+    src_lo[i] = bench_key (&keys[i], i, SERVER_PORT);
+  }
+  bench_stop (&t, "make_key", n_flows);
+
+  BV (clib_bihash_init) (&table, "bench flow table", n_buckets, memory);
+
+  bench_start (&t);
+  for (i = 0; i < n_flows; i++) {
+    clib_memcpy (kv.key, keys[i].as_u64, sizeof (kv.key));
+    kv.value = latency_kv_value (i, src_lo[i]);
+    if (BV (clib_bihash_add_del) (&table, &kv, 1 /* is_add */)) {
+      fformat (stderr, "insert failed after %u flows, table memory full\n",
+               i);
+      return 1;
+    }
+  }
+  bench_stop (&t, "insert", n_flows);
+
+  bench_start (&t);
+  for (i = 0; i < n_flows; i++) {
+    clib_memcpy (kv.key, keys[order[i]].as_u64, sizeof (kv.key));
+    n_found += BV (clib_bihash_search) (&table, &kv, &kv_return) == 0;
+  }
+  bench_stop (&t, "lookup hit", n_flows);
+  if (n_found != n_flows) {
+    fformat (stderr, "only %u of %u flows found\n", n_found, n_flows);
+    return 1;
+  }
+
+  /* Same clients towards another port, none of them is in the table */
+  for (i = 0; i < n_flows; i++) {
+    bench_key (&keys[i], i, SERVER_PORT + 1);
+  }
+  n_found = 0;
+  bench_start (&t);
+  for (i = 0; i < n_flows; i++) {
+    clib_memcpy (kv.key, keys[order[i]].as_u64, sizeof (kv.key));
+    n_found += BV (clib_bihash_search) (&table, &kv, &kv_return) == 0;
+  }
+  bench_stop (&t, "lookup miss", n_flows);
+  if (n_found) {
+    fformat (stderr, "%u unknown flows found\n", n_found);
+    return 1;
+  }
+
+  fformat (stdout, "%U", BV (format_bihash), &table, 0 /* verbose */);
+
+  bench_collisions (n_flows, 0 /* servers */, seed);
+  bench_collisions (n_flows, 1 /* servers */, seed);
+
+  BV (clib_bihash_free) (&table);
+  vec_free (keys);
+  vec_free (src_lo);
+  vec_free (order);
+  return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ *------------------------------------------------------------------
+ * bench_session_layout.c - session layout benchmark
+ *
+ * bench_session_layout [<sessions> [<packets>]]
+ *
+ * Per packet session access in random flow order, with the session layout
+ * before and after the hot/cold split of latency_session_t:
+ * - two lines: the keys of both NAT legs in the session, 100 bytes, in a
+ *   pool without alignment
+ * - one line: only the hot fields, 64 bytes, cache line aligned
+ * Each packet reads and updates the fields the packet path uses. Runs
+ * once without prefetch and once prefetching one cache line per session
+ * a few packets ahead, like the batched lookup of the node.
+ *
+ * Plain C on purpose, the layouts are copied from latency.h, so it runs
+ * without VPP: cc -O2 -o bench_session_layout bench_session_layout.c
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define CACHE_LINE 64
+#define PREFETCH_AHEAD 4
+
+typedef union {
+  struct {
+    u32 ip_lo;
+    u32 ip_hi;
+    u16 port_lo;
+    u16 port_hi;
+    u8 protocol;
+    u8 pad[3];
+    u64 cat;
+  };
+  u64 as_u64[3];
+} __attribute__ ((packed)) bench_key_t;
+
+/* latency_session_t before the split */
+typedef struct {
+  u32 state;
+  u32 p_type;
+  u32 index;
+  u32 timer;
+  struct {
+    bench_key_t key;
+    bench_key_t key_reverse;
+  };
+  u8 is_ip6;
+  u32 init_src_ip;
+  u16 init_src_port;
+  u32 new_dst_ip;
+  u32 init_dst_ip;
+  u32 mb_ip;
+  u16 csum_delta_fwd;
+  u16 csum_delta_rev;
+  u32 pkt_count;
+  u32 observer_index;
+} bench_session_2l_t;
+
+/* latency_session_t after the split */
+typedef struct {
+  u8 state;
+  u8 p_type;
+  u8 is_ip6;
+  u32 index;
+  u32 timer;
+  u32 init_src_ip;
+  u16 init_src_port;
+  u32 new_dst_ip;
+  u32 init_dst_ip;
+  u32 mb_ip;
+  u16 csum_delta_fwd;
+  u16 csum_delta_rev;
+  u32 pkt_count;
+  u32 observer_index;
+} __attribute__ ((aligned (CACHE_LINE))) bench_session_1l_t;
+
+/* Fields of the packet path: state and type, NAT, packet count, timer
+ * restart and observer lookup */
+#define BENCH_PACKET(s, sum)                                   \
+do {                                                           \
+  (s)->pkt_count++;                                            \
+  (sum) += (s)->state + (s)->p_type + (s)->is_ip6              \
+    + (s)->new_dst_ip + (s)->mb_ip + (s)->csum_delta_fwd       \
+    + (s)->timer + (s)->observer_index;                        \
+} while (0)
+
+#define BENCH_RUN(sessions, order, n_packets, prefetch, sum)            \
+do {                                                                    \
+  u32 _i;                                                               \
+  for (_i = 0; _i < (n_packets); _i++) {                                \
+    if (prefetch && _i + PREFETCH_AHEAD < (n_packets))                  \
+      __builtin_prefetch (&(sessions)[(order)[_i + PREFETCH_AHEAD]]);   \
+    BENCH_PACKET (&(sessions)[(order)[_i]], sum);                       \
+  }                                                                     \
+} while (0)
+
+static double now_ns (void) {
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static u32 random_u32 (u32 * seed) {
+  /* Numerical Recipes LCG, like vppinfra random_u32 */
+  *seed = 1664525 * *seed + 1013904223;
+  return *seed;
+}
+
+int main (int argc, char * argv[]) {
+  u32 n_sessions = argc > 1 ? strtoul (argv[1], 0, 0) : 1 << 20;
+  u32 n_packets = argc > 2 ? strtoul (argv[2], 0, 0) : 1 << 24;
+  bench_session_2l_t * s2;
+  bench_session_1l_t * s1;
+  u32 * order, i, seed = 0xdeadbeef;
+  volatile u64 sink;
+  u64 sum = 0;
+  u8 * s2_base;
+  int prefetch;
+  double t;
+
+  if (!n_sessions || !n_packets) {
+    fprintf (stderr, "usage: %s [<sessions> [<packets>]]\n", argv[0]);
+    return 1;
+  }
+
+  /* The old pool only guaranteed 8 byte alignment */
+  s2_base = aligned_alloc (CACHE_LINE, (size_t) n_sessions * sizeof (*s2)
+                           + CACHE_LINE);
+  s2 = (bench_session_2l_t *) (s2_base + 8);
+  s1 = aligned_alloc (CACHE_LINE, (size_t) n_sessions * sizeof (*s1));
+  order = malloc ((size_t) n_packets * sizeof (*order));
+  if (!s2_base || !s1 || !order) {
+    fprintf (stderr, "out of memory\n");
+    free (s2_base);
+    free (s1);
+    free (order);
+    return 1;
+  }
+  memset (s2, 0x11, (size_t) n_sessions * sizeof (*s2));
+  memset (s1, 0x11, (size_t) n_sessions * sizeof (*s1));
+  for (i = 0; i < n_packets; i++) {
+    order[i] = random_u32 (&seed) % n_sessions;
+  }
+
+  printf ("%u sessions, %u packets, %zu/%zu bytes/session\n", n_sessions,
+          n_packets, sizeof (*s2), sizeof (*s1));
+  for (prefetch = 0; prefetch <= 1; prefetch++) {
+    t = now_ns ();
+    BENCH_RUN (s2, order, n_packets, prefetch, sum);
+    printf ("two lines%s: %.1f ns/packet\n", prefetch ? ", prefetch" : "",
+            (now_ns () - t) / n_packets);
+
+    t = now_ns ();
+    BENCH_RUN (s1, order, n_packets, prefetch, sum);
+    printf ("one line%s: %.1f ns/packet\n", prefetch ? ", prefetch" : "",
+            (now_ns () - t) / n_packets);
+  }
+
+  /* Keep the loads */
+  sink = sum;
+  (void) sink;
+
+  free (s2_base);
+  free (s1);
+  free (order);
+  return 0;
+}
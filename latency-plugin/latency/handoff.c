@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * @brief Latency plugin, flow to worker handoff.
+ *
+ * With several workers, RSS spreads the client->MB and server->MB legs of
+ * a flow over different workers since the NAT rewrite gives both legs a
+ * different 5-tuple. This node runs in front of the latency node and
+ * hands every packet to the worker owning the flow, such that the per
+ * thread flow state never needs any locking.
+ */
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vlib/threads.h>
+#include <vppinfra/xxhash.h>
+#include <latency/latency.h>
+#include <latency/plus_packet.h>
+
+vlib_node_registration_t latency_handoff_node;
+vlib_node_registration_t latency_ip6_handoff_node;
+
+/* Used to display the handoff decision in the packet trace */
+typedef struct {
+  u32 next_worker_index;
+  u32 hash;
+} latency_handoff_trace_t;
+
+/* packet trace format function */
+static u8 * format_latency_handoff_trace (u8 * s, va_list * args) {
+  /* Ignore two first arguments */
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+
+  latency_handoff_trace_t * t = va_arg (*args, latency_handoff_trace_t *);
+
+  s = format (s, "LATENCY handoff: next worker %u, flow hash 0x%08x",
+              t->next_worker_index, t->hash);
+
+  return s;
+}
+
+#define foreach_latency_handoff_error \
+_(CONGESTION_DROP, "congestion drop")
+
+typedef enum {
+#define _(sym,str) LATENCY_HANDOFF_ERROR_##sym,
+  foreach_latency_handoff_error
+#undef _
+  LATENCY_HANDOFF_N_ERROR,
+} latency_handoff_error_t;
+
+static char * latency_handoff_error_strings[] = {
+#define _(sym,string) string,
+  foreach_latency_handoff_error
+#undef _
+};
+
+/* Frame queue elements filled above this are considered congested */
+#define LATENCY_HANDOFF_QUEUE_HI_THRESHOLD 30
+
+/**
+ * @brief hash a packet on the flow identity shared by both NAT legs
+ *
+ * Uses the ports, protocol and CAT of the make_key/make_plus_key flow
+ * identity. The IPs are left out since the NAT rewrite makes them differ
+ * between the two legs of a flow, the port pair is XORed such that both
+ * directions hash the same. IPv6 flows are hashed the same way. Packets
+ * too short for the IP header and the ports get hash 0, i.e. the first
+ * worker, nothing is read beyond current_length. Returns false for other
+ * packets the latency node ignores, those stay on the current thread.
+ */
+always_inline bool
+latency_handoff_hash (vlib_buffer_t * b0, u32 * hash, int is_ip6) {
+  udp_header_t * udp0;
+  u32 l3_size;
+  u32 protocol;
+  u64 cat = 0;
+
+  *hash = 0;
+  if (is_ip6) {
+    u8 * data = vlib_buffer_get_current (b0);
+    if (PREDICT_FALSE(b0->current_length < sizeof (ip6_header_t))) {
+      return true;
+    }
+    l3_size = latency_ip6_l4_offset (data, b0->current_length, &protocol);
+    udp0 = (udp_header_t *) (data + l3_size);
+  } else {
+    ip4_header_t * ip0 = vlib_buffer_get_current (b0);
+    if (PREDICT_FALSE(b0->current_length < sizeof (ip4_header_t))) {
+      return true;
+    }
+    if (PREDICT_FALSE((ip0->ip_version_and_header_length & 0xF0) != 0x40)) {
+      return false;
+    }
+    l3_size = sizeof (ip4_header_t);
+    protocol = ip0->protocol;
+    /* TCP has the ports at the same offset as UDP */
+    udp0 = (udp_header_t *) (ip0 + 1);
+  }
+
+  if (PREDICT_FALSE(b0->current_length < l3_size + sizeof (udp_header_t))) {
+    return true;
+  }
+  if (protocol != IP_PROTOCOL_UDP && protocol != IP_PROTOCOL_TCP) {
+    return false;
+  }
+
+  /* PLUS flows are keyed on the CAT as well */
+  if (protocol == IP_PROTOCOL_UDP
+      && !is_quic(udp0->src_port, udp0->dst_port)
+      && b0->current_length >= l3_size + sizeof (udp_header_t)
+                               + sizeof (plus_header_t)) {
+    plus_header_t * plus0 = (plus_header_t *) (udp0 + 1);
+    if ((plus0->magic_and_flags & MAGIC_MASK) == MAGIC) {
+      cat = plus0->CAT;
+    }
+  }
+
+  *hash = clib_xxhash (((u64) (udp0->src_port ^ udp0->dst_port) << 32
+                        | protocol) ^ cat);
+  return true;
+}
+
+/**
+ * @brief Handoff loop function (based on the VPP worker handoff node)
+ *
+ * Shared by the IPv4 and IPv6 handoff node, each hands off to its own
+ * latency node through its own frame queue.
+ */
+always_inline uword
+latency_handoff_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
+                        vlib_frame_t * frame, int is_ip6) {
+  latency_main_t * pm = &latency_main;
+  u32 next_node_index = is_ip6 ? latency_ip6_node.index : latency_node.index;
+  u32 fq_index = is_ip6 ? pm->fq_index6 : pm->fq_index;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  u32 n_left_from, * from, * to_next = 0, * to_next_drop = 0;
+  /* Separate per node, both nodes use different frame queues */
+  static __thread vlib_frame_queue_elt_t ** handoff_elts_by_af[2];
+  static __thread vlib_frame_queue_t ** congested_by_af[2];
+  vlib_frame_queue_elt_t * hf = 0;
+  vlib_frame_queue_t * fq;
+  vlib_frame_t * f = 0, * d = 0;
+  int i;
+  u32 n_left_to_next_worker = 0, * to_next_worker = 0;
+  u32 next_worker_index = 0;
+  u32 current_worker_index = ~0;
+  u32 thread_index = vlib_get_thread_index ();
+
+  if (PREDICT_FALSE(handoff_elts_by_af[is_ip6] == 0)) {
+    vec_validate (handoff_elts_by_af[is_ip6], tm->n_vlib_mains - 1);
+
+    vec_validate_init_empty (congested_by_af[is_ip6],
+                             tm->n_vlib_mains - 1,
+                             (vlib_frame_queue_t *) (~0));
+  }
+  vlib_frame_queue_elt_t ** handoff_queue_elt_by_worker_index =
+    handoff_elts_by_af[is_ip6];
+  vlib_frame_queue_t ** congested_handoff_queue_by_worker_index =
+    congested_by_af[is_ip6];
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  while (n_left_from > 0) {
+    u32 bi0;
+    vlib_buffer_t * b0;
+    u32 hash0 = 0;
+
+    bi0 = from[0];
+    from += 1;
+    n_left_from -= 1;
+
+    b0 = vlib_get_buffer (vm, bi0);
+
+    if (PREDICT_TRUE(latency_handoff_hash (b0, &hash0, is_ip6))) {
+      next_worker_index = pm->first_worker_index + (hash0 % pm->num_workers);
+    } else {
+      next_worker_index = thread_index;
+    }
+
+    /* Trace before the buffer is handed to another thread */
+    if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)
+        && (b0->flags & VLIB_BUFFER_IS_TRACED))) {
+      latency_handoff_trace_t *t = vlib_add_trace (vm, node, b0, sizeof (*t));
+      t->next_worker_index = next_worker_index;
+      t->hash = hash0;
+    }
+
+    if (next_worker_index != thread_index) {
+      if (next_worker_index != current_worker_index) {
+        fq = is_vlib_frame_queue_congested (
+            fq_index, next_worker_index,
+            LATENCY_HANDOFF_QUEUE_HI_THRESHOLD,
+            congested_handoff_queue_by_worker_index);
+
+        if (fq) {
+          /* if this is 1st frame */
+          if (!d) {
+            d = vlib_get_frame_to_node (vm, pm->error_drop_node_index);
+            to_next_drop = vlib_frame_vector_args (d);
+          }
+
+          to_next_drop[0] = bi0;
+          to_next_drop += 1;
+          d->n_vectors++;
+          b0->error = node->errors[LATENCY_HANDOFF_ERROR_CONGESTION_DROP];
+          continue;
+        }
+
+        if (hf) {
+          hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+        }
+
+        hf = vlib_get_worker_handoff_queue_elt (fq_index,
+                                                next_worker_index,
+                                                handoff_queue_elt_by_worker_index);
+
+        n_left_to_next_worker = VLIB_FRAME_SIZE - hf->n_vectors;
+        to_next_worker = &hf->buffer_index[hf->n_vectors];
+        current_worker_index = next_worker_index;
+      }
+
+      /* enqueue to correct worker thread */
+      to_next_worker[0] = bi0;
+      to_next_worker++;
+      n_left_to_next_worker--;
+
+      if (n_left_to_next_worker == 0) {
+        hf->n_vectors = VLIB_FRAME_SIZE;
+        vlib_put_frame_queue_elt (hf);
+        current_worker_index = ~0;
+        handoff_queue_elt_by_worker_index[next_worker_index] = 0;
+        hf = 0;
+      }
+    } else {
+      /* if this is 1st frame */
+      if (!f) {
+        f = vlib_get_frame_to_node (vm, next_node_index);
+        to_next = vlib_frame_vector_args (f);
+      }
+
+      to_next[0] = bi0;
+      to_next += 1;
+      f->n_vectors++;
+    }
+  }
+
+  if (f) {
+    vlib_put_frame_to_node (vm, next_node_index, f);
+  }
+
+  if (d) {
+    vlib_put_frame_to_node (vm, pm->error_drop_node_index, d);
+  }
+
+  if (hf) {
+    hf->n_vectors = VLIB_FRAME_SIZE - n_left_to_next_worker;
+  }
+
+  /* Ship frames to the worker nodes */
+  for (i = 0; i < vec_len (handoff_queue_elt_by_worker_index); i++) {
+    if (handoff_queue_elt_by_worker_index[i]) {
+      hf = handoff_queue_elt_by_worker_index[i];
+      /* Always ship the handoff queue element, the receiving worker
+       * rate-adapts by itself */
+      vlib_put_frame_queue_elt (hf);
+      handoff_queue_elt_by_worker_index[i] = 0;
+    }
+    congested_handoff_queue_by_worker_index[i] = (vlib_frame_queue_t *) (~0);
+  }
+
+  return frame->n_vectors;
+}
+
+static uword
+latency_handoff_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+                         vlib_frame_t * frame) {
+  return latency_handoff_inline (vm, node, frame, 0 /* is_ip6 */);
+}
+
+static uword
+latency_ip6_handoff_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+                             vlib_frame_t * frame) {
+  return latency_handoff_inline (vm, node, frame, 1 /* is_ip6 */);
+}
+
+VLIB_REGISTER_NODE (latency_handoff_node) = {
+  .function = latency_handoff_node_fn,
+  .name = "latency-handoff",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_handoff_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(latency_handoff_error_strings),
+  .error_strings = latency_handoff_error_strings,
+
+  /* Packets are sent to the latency node (or dropped) directly */
+  .n_next_nodes = 0,
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (latency_handoff_node, latency_handoff_node_fn)
+
+VLIB_REGISTER_NODE (latency_ip6_handoff_node) = {
+  .function = latency_ip6_handoff_node_fn,
+  .name = "latency-ip6-handoff",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_handoff_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(latency_handoff_error_strings),
+  .error_strings = latency_handoff_error_strings,
+
+  /* Packets are sent to the latency-ip6 node (or dropped) directly */
+  .n_next_nodes = 0,
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (latency_ip6_handoff_node,
+                              latency_ip6_handoff_node_fn)
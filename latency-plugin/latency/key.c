@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * @brief Latency plugin, flow keys.
+ *
+ * Kept apart from the plugin setup such that the benchmarks can link them
+ * without vlib (see bench_flow_table.c).
+ */
+
+#include <vnet/vnet.h>
+#include <latency/latency.h>
+
+/**
+ *  @brief create the hash key
+ *
+ *  The (IP, port) endpoints are ordered such that both directions of a
+ *  flow give the same key. A src_ip of 0 stands for the MB IP.
+ *  Returns 1 if the src endpoint is the lo endpoint of the key.
+ */
+u8 make_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
+            u16 src_p, u16 dst_p, u8 protocol) {
+  u8 src_lo;
+  if (src_ip == 0) {
+    src_ip = latency_main.mb_ip;
+  }
+  memset(kv, 0, sizeof (*kv));
+  src_lo = src_ip < dst_ip || (src_ip == dst_ip && src_p <= dst_p);
+  if (src_lo) {
+    kv->ip_lo = src_ip;
+    kv->ip_hi = dst_ip;
+    kv->port_lo = src_p;
+    kv->port_hi = dst_p;
+  } else {
+    kv->ip_lo = dst_ip;
+    kv->ip_hi = src_ip;
+    kv->port_lo = dst_p;
+    kv->port_hi = src_p;
+  }
+  kv->protocol = protocol;
+  return src_lo;
+}
+
+u8 make_plus_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
+                u16 src_p, u16 dst_p, u8 protocol, u64 cat) {
+  u8 src_lo = make_key(kv, src_ip, dst_ip, src_p, dst_p, protocol);
+  kv->cat = cat;
+  return src_lo;
+}
+
+/**
+ *  @brief create the hash key of an IPv6 flow, ordered as in make_key
+ */
+u8 make_key6(latency_key6_t * kv, ip6_address_t * src_ip,
+             ip6_address_t * dst_ip, u16 src_p, u16 dst_p, u8 protocol) {
+  int cmp = memcmp(src_ip, dst_ip, sizeof (ip6_address_t));
+  u8 src_lo = cmp < 0 || (cmp == 0 && src_p <= dst_p);
+  memset(kv, 0, sizeof (*kv));
+  if (src_lo) {
+    kv->ip_lo = *src_ip;
+    kv->ip_hi = *dst_ip;
+    kv->port_lo = src_p;
+    kv->port_hi = dst_p;
+  } else {
+    kv->ip_lo = *dst_ip;
+    kv->ip_hi = *src_ip;
+    kv->port_lo = dst_p;
+    kv->port_hi = src_p;
+  }
+  kv->protocol = protocol;
+  return src_lo;
+}
+
+u8 make_plus_key6(latency_key6_t * kv, ip6_address_t * src_ip,
+                ip6_address_t * dst_ip, u16 src_p, u16 dst_p, u8 protocol,
+                u64 cat) {
+  u8 src_lo = make_key6(kv, src_ip, dst_ip, src_p, dst_p, protocol);
+  kv->cat = cat;
+  return src_lo;
+}
@@ -56,6 +56,8 @@
 #define foreach_latency_plugin_api_msg                           \
 _(LATENCY_ENABLE_DISABLE, latency_enable_disable)
 
+latency_main_t latency_main;
+
 /* *INDENT-OFF* */
 VLIB_PLUGIN_REGISTER () = {
   .version = LATENCY_PLUGIN_BUILD_VER,
@@ -85,8 +87,25 @@ int latency_enable_disable (latency_main_t * pm, u32 sw_if_index,
     return VNET_API_ERROR_INVALID_SW_IF_INDEX;
   
  
-  vnet_feature_enable_disable ("ip4-unicast", "latency",
-                               sw_if_index, enable_disable, 0, 0);
+  /* With several workers, both legs of a flow are first handed to the
+   * worker owning the flow */
+  if (pm->num_workers > 1) {
+    if (pm->fq_index == ~0) {
+      pm->fq_index = vlib_frame_queue_main_init (latency_node.index, 0);
+    }
+    if (pm->fq_index6 == ~0) {
+      pm->fq_index6 = vlib_frame_queue_main_init (latency_ip6_node.index, 0);
+    }
+    vnet_feature_enable_disable ("ip4-unicast", "latency-handoff",
+                                 sw_if_index, enable_disable, 0, 0);
+    vnet_feature_enable_disable ("ip6-unicast", "latency-ip6-handoff",
+                                 sw_if_index, enable_disable, 0, 0);
+  } else {
+    vnet_feature_enable_disable ("ip4-unicast", "latency",
+                                 sw_if_index, enable_disable, 0, 0);
+    vnet_feature_enable_disable ("ip6-unicast", "latency-ip6",
+                                 sw_if_index, enable_disable, 0, 0);
+  }
   return rv;
 }
 
@@ -141,50 +160,80 @@ latency_enable_disable_command_fn (vlib_main_t * vm,
  */
 u8 * format_sessions(u8 *s, va_list *args) {
   latency_main_t * pm = &latency_main;
+  latency_per_thread_t * ptd;
+
+  /* Sums of the counters of all threads */
+#define _(sym,str) \
+  s = format(s, "%s: %Lu\n", str, \
+             vlib_get_simple_counter (&pm->counters, LATENCY_COUNTER_##sym));
+  foreach_latency_counter
+#undef _
 
-  s = format(s, "Total flows: %u, total active flows: %u\n",
-                  pm->total_flows, pm->active_flows);
   latency_session_t * session;
+  tcp_observer_t * tcp;
+  tcp_ts_observer_t * ts;
+  quic_observer_t * quic;
+  plus_observer_t * plus;
   
   s = format(s, "=======================================================\n");
   
-  /* Iterate through all pool entries */
-  pool_foreach (session, pm->session_pool, ({
+  /* Iterate through all pool entries of all threads */
+  vec_foreach (ptd, pm->per_thread) {
+  pool_foreach (session, ptd->session_pool, ({
     switch (session->p_type) {
       case P_TCP:
+        tcp = latency_tcp(ptd, session);
         s = format(s, "TCP: observed packets: %u\n", session->pkt_count);
+        if (!tcp) {
+          s = format(s, "no VEC or timestamps observed\n");
+          break;
+        }
         s = format(s, "VEC (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->tcp->status_spin_observer.rtt_client,
-                   STAT_PRECISION, session->tcp->status_spin_observer.rtt_server);
+                   STAT_PRECISION, latency_us_to_s(tcp->status_spin_observer.rtt[0]),
+                   STAT_PRECISION, latency_us_to_s(tcp->status_spin_observer.rtt[1]));
+        ts = latency_tcp_ts(ptd, tcp);
+        if (!ts) {
+          s = format(s, "no timestamps observed\n");
+          break;
+        }
         s = format(s, "TS single (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->tcp->ts_one_RTT_observer.rtt_client,
-                   STAT_PRECISION, session->tcp->ts_one_RTT_observer.rtt_server);
+                   STAT_PRECISION, latency_us_to_s(ts->ts_one_RTT_observer.rtt[0]),
+                   STAT_PRECISION, latency_us_to_s(ts->ts_one_RTT_observer.rtt[1]));
         s = format(s, "TS all (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->tcp->ts_all_RTT_observer.rtt_client,
-                   STAT_PRECISION, session->tcp->ts_all_RTT_observer.rtt_server);
+                   STAT_PRECISION, latency_us_to_s(ts->ts_all_RTT_observer.rtt[0]),
+                   STAT_PRECISION, latency_us_to_s(ts->ts_all_RTT_observer.rtt[1]));
       break;
       
       case P_QUIC:
+        quic = latency_quic(ptd, session);
         s = format(s, "QUIC: observed packets: %u\n", session->pkt_count);
+        if (!quic) {
+          s = format(s, "no spin bit observed\n");
+          break;
+        }
         s = format(s, "Spin basic (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->quic->basic_spin_observer.rtt_client,
-                   STAT_PRECISION, session->quic->basic_spin_observer.rtt_server);
+                   STAT_PRECISION, latency_us_to_s(quic->basic_spin_observer.rtt[0]),
+                   STAT_PRECISION, latency_us_to_s(quic->basic_spin_observer.rtt[1]));
         s = format(s, "Spin pn (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->quic->pn_spin_observer.rtt_client,
-                   STAT_PRECISION, session->quic->pn_spin_observer.rtt_server);
+                   STAT_PRECISION, latency_us_to_s(quic->pn_spin_observer.rtt[0]),
+                   STAT_PRECISION, latency_us_to_s(quic->pn_spin_observer.rtt[1]));
         s = format(s, "VEC (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->quic->status_spin_observer.rtt_client,
-                   STAT_PRECISION, session->quic->status_spin_observer.rtt_server);
+                   STAT_PRECISION, latency_us_to_s(quic->status_spin_observer.rtt[0]),
+                   STAT_PRECISION, latency_us_to_s(quic->status_spin_observer.rtt[1]));
         s = format(s, "Spin heur (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->quic->dyna_heur_spin_observer.rtt_client[session->quic->dyna_heur_spin_observer.index_client],
-                   STAT_PRECISION, session->quic->dyna_heur_spin_observer.rtt_server[session->quic->dyna_heur_spin_observer.index_server]);
+                   STAT_PRECISION, latency_us_to_s(quic->dyna_heur_spin_observer.rtt[0][quic->dyna_heur_spin_observer.index[0]]),
+                   STAT_PRECISION, latency_us_to_s(quic->dyna_heur_spin_observer.rtt[1][quic->dyna_heur_spin_observer.index[1]]));
       break;
       
       case P_PLUS:
+        plus = latency_plus(ptd, session);
         s = format(s, "PLUS: observed packets: %u\n", session->pkt_count);
+        if (!plus) {
+          break;
+        }
         s = format(s, "PSN/PSE (client, server): %.*lfs %.*lfs\n",
-                   STAT_PRECISION, session->plus->plus_single_observer.rtt_src,
-                   STAT_PRECISION, session->plus->plus_single_observer.rtt_dst);
+                   STAT_PRECISION, latency_us_to_s(plus->plus_single_observer.rtt[0]),
+                   STAT_PRECISION, latency_us_to_s(plus->plus_single_observer.rtt[1]));
       break;
 
       default:
@@ -193,6 +242,7 @@ u8 * format_sessions(u8 *s, va_list *args) {
     } 
     s = format(s, "=======================================================\n");
   }));
+  }
   return s;
 }
 
@@ -220,7 +270,8 @@ static clib_error_t * latency_add_port_fn(vlib_main_t * vm,
     return clib_error_return (0, "Please specify a correct port."); 
   }
 
-  hash_set(pm->hash_quic_ports, clib_host_to_net_u16(quic_port), 1);
+  pm->quic_port_bitmap = clib_bitmap_set(pm->quic_port_bitmap,
+                                         clib_host_to_net_u16(quic_port), 1);
   
   return 0;
 }
@@ -249,6 +300,8 @@ static clib_error_t * latency_add_nat_fn(vlib_main_t * vm,
   hash_set(pm->hash_server_ports_to_ips,
            clib_host_to_net_u16(port),
            clib_host_to_net_u32(ip4.as_u32));
+  pm->nat_port_bitmap = clib_bitmap_set(pm->nat_port_bitmap,
+                                        clib_host_to_net_u16(port), 1);
 
   return 0;
 }
@@ -276,6 +329,89 @@ static clib_error_t * latency_add_ip_fn(vlib_main_t * vm,
   return 0;
 }
 
+static clib_error_t * latency_set_housekeeping_fn(vlib_main_t * vm,
+              unformat_input_t * input, vlib_cli_command_t * cmd) {
+  latency_main_t * pm = &latency_main;
+  u32 interval_ms = 0;
+
+  if (!unformat (input, "%d", &interval_ms) || interval_ms == 0) {
+    return clib_error_return (0, "Please specify an interval in ms, e.g.: latency housekeeping 100");
+  }
+
+  pm->housekeeping_interval = interval_ms * 1e-3;
+
+  /* Wake up the process such that the new interval is used right away */
+  vlib_process_signal_event (vm, latency_housekeeping_node.index,
+                             LATENCY_EVENT_INTERVAL, 0);
+
+  return 0;
+}
+
+static clib_error_t * latency_set_mode_fn(vlib_main_t * vm,
+              unformat_input_t * input, vlib_cli_command_t * cmd) {
+  latency_main_t * pm = &latency_main;
+
+  if (unformat (input, "passive")) {
+    pm->passive = 1;
+  } else if (unformat (input, "forward")) {
+    pm->passive = 0;
+  } else {
+    return clib_error_return (0, "Please specify a mode, e.g.: latency mode passive");
+  }
+
+  return 0;
+}
+
+static clib_error_t * latency_set_output_fn(vlib_main_t * vm,
+              unformat_input_t * input, vlib_cli_command_t * cmd) {
+  latency_main_t * pm = &latency_main;
+
+  if (unformat (input, "csv")) {
+    pm->output_mode = LATENCY_OUTPUT_MODE_CSV;
+  } else if (unformat (input, "binary")) {
+    pm->output_mode = LATENCY_OUTPUT_MODE_BINARY;
+  } else if (unformat (input, "summary")) {
+    pm->output_mode = LATENCY_OUTPUT_MODE_SUMMARY;
+  } else {
+    return clib_error_return (0, "Please specify an output, e.g.: latency output binary");
+  }
+
+  /* Retry a binary log segment which could not be created */
+  pm->log_failed = 0;
+
+  return 0;
+}
+
+static clib_error_t * latency_set_deadband_fn(vlib_main_t * vm,
+              unformat_input_t * input, vlib_cli_command_t * cmd) {
+  latency_main_t * pm = &latency_main;
+  u32 abs_us = 0, rel = 0, interval_ms = 0;
+
+  if (unformat (input, "off")) {
+    pm->deadband = 0;
+    return 0;
+  }
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (input, "abs %u", &abs_us))
+      ;
+    else if (unformat (input, "rel %u", &rel))
+      ;
+    else if (unformat (input, "interval %u", &interval_ms))
+      ;
+    else
+      return clib_error_return (0, "unknown input '%U'",
+                                format_unformat_error, input);
+  }
+
+  pm->deadband_abs = abs_us;
+  pm->deadband_rel = rel;
+  pm->deadband_interval = (u64) interval_ms * 1000;
+  pm->deadband = 1;
+
+  return 0;
+}
+
 /**
  * @brief CLI command to enable/disable the latency plugin.
  */
@@ -331,6 +467,43 @@ VLIB_CLI_COMMAND (sr_content_command_ip, static) = {
   .function = latency_add_ip_fn,
 };
 
+/**
+ * @brief CLI command to set the timer expiry interval
+ */
+VLIB_CLI_COMMAND (sr_content_command_housekeeping, static) = {
+  .path = "latency housekeeping",
+  .short_help = "Set timer expiry interval: latency housekeeping <ms>",
+  .function = latency_set_housekeeping_fn,
+};
+
+/**
+ * @brief CLI command to switch between forwarding (NAT) and passive mode
+ */
+VLIB_CLI_COMMAND (sr_content_command_mode, static) = {
+  .path = "latency mode",
+  .short_help = "Forward (NAT) or only observe and drop packets: latency mode <forward|passive>",
+  .function = latency_set_mode_fn,
+};
+
+/**
+ * @brief CLI command to choose between CSV files, the binary RTT log and
+ * per flow summaries
+ */
+VLIB_CLI_COMMAND (sr_content_command_output, static) = {
+  .path = "latency output",
+  .short_help = "Write RTT samples as CSV or binary log, or flow summaries only: latency output <csv|binary|summary>",
+  .function = latency_set_output_fn,
+};
+
+/**
+ * @brief CLI command to only queue RTT samples which changed noticeably
+ */
+VLIB_CLI_COMMAND (sr_content_command_deadband, static) = {
+  .path = "latency deadband",
+  .short_help = "Only output RTT samples outside a deadband: latency deadband [abs <us>] [rel <percent>] [interval <ms>] | off",
+  .function = latency_set_deadband_fn,
+};
+
 /**
  * @brief LATENCY API message handler.
  */
@@ -378,583 +551,336 @@ setup_message_id_table (latency_main_t * pm, api_main_t *am) {
 #undef _
 }
 
-/**
- *  @brief create the hash key
- */
-void make_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
-              u16 src_p, u16 dst_p, u8 protocol) {
-  if (src_ip == 0) {
-    src_ip = latency_main.mb_ip;
-  }
-  kv->s_x_d_ip = src_ip ^ dst_ip;
-  kv->s_x_d_port = src_p ^ dst_p;
-  kv->protocol = protocol;
-}
-
-void make_plus_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
-                u16 src_p, u16 dst_p, u8 protocol, u64 cat) {
-  make_key(kv, src_ip, dst_ip, src_p, dst_p, protocol);
-  kv->as_u64 = kv->as_u64 ^ cat;
-}
-
 /**
  *  @brief get session pointer if corresponding key is known
+ *
+ *  client_lo is set to the LATENCY_KV_CLIENT_LO bit of the key.
  */
-latency_session_t * get_session_from_key(latency_key_t * kv_in) {
+latency_session_t * get_session_from_key(latency_per_thread_t * ptd,
+                latency_key_t * kv_in, u8 * client_lo) {
   BVT(clib_bihash_kv) kv, kv_return;
-  latency_main_t *pm = &latency_main;
   BVT(clib_bihash) *bi_table;
-  bi_table = &pm->latency_table;
-  kv.key = kv_in->as_u64;
+  bi_table = &ptd->latency_table;
+  clib_memcpy (kv.key, kv_in->as_u64, sizeof (kv.key));
   int rv = BV(clib_bihash_search) (bi_table, &kv, &kv_return);
   if (rv != 0) {
     /* Key does not exist */
     return 0;
   } else {
-    return get_latency_session(kv_return.value);
+    *client_lo = (kv_return.value & LATENCY_KV_CLIENT_LO) != 0;
+    return get_latency_session(ptd, (u32) kv_return.value);
   }
 }
 
-bool ip_nat_translation(ip4_header_t *ip0, u32 init_src_ip, u32 new_dst_ip) {
-  if (ip0->src_address.as_u32 == init_src_ip) {
-    ip0->src_address.as_u32 = latency_main.mb_ip;
-    ip0->dst_address.as_u32 = new_dst_ip;
-    return true;
-  }
-  if (ip0->src_address.as_u32 == new_dst_ip) {
-    ip0->src_address.as_u32 = latency_main.mb_ip;
-    ip0->dst_address.as_u32 = init_src_ip;
-    return true;
+/**
+ *  @brief get session pointer if corresponding IPv6 key is known
+ */
+latency_session_t * get_session_from_key6(latency_per_thread_t * ptd,
+                latency_key6_t * kv_in, u8 * client_lo) {
+  clib_bihash_kv_48_8_t kv, kv_return;
+  clib_memcpy (kv.key, kv_in->as_u64, sizeof (kv.key));
+  if (clib_bihash_search_48_8 (&ptd->latency_table6, &kv, &kv_return) != 0) {
+    /* Key does not exist */
+    return 0;
   }
-  return false;
+  *client_lo = (kv_return.value & LATENCY_KV_CLIENT_LO) != 0;
+  return get_latency_session(ptd, (u32) kv_return.value);
 }
 
 /* Update all RTT estimations for QUIC packets */
 void update_quic_rtt_estimate(vlib_main_t * vm, quic_observer_t * session,
-            f64 now, u16 src_port, u16 init_src_port, u8 measurement,
-            u32 packet_number, u32 pkt_count) {
+            u64 now, u8 dir, u8 measurement, u32 packet_number, bool first) {
 
   bool spin = measurement & ONE_BIT_SPIN;
   u8 status_bits = (measurement & STATUS_MASK) >> STATUS_SHIFT;
   bool basic = basic_latency_estimate(vm, &(session->basic_spin_observer),
-            now, src_port, init_src_port, spin);
+            now, dir, spin);
   
   // TODO: will fail if packet number is 0
   bool pn = false;
   if (packet_number) {
     pn = pn_latency_estimate(vm, &(session->pn_spin_observer),
-            now, src_port, init_src_port, spin, packet_number);
+            now, dir, spin, packet_number);
   }
   /* VEC estimator */
   bool status = status_estimate(vm, &(session->status_spin_observer),
-            now, src_port, init_src_port, spin, status_bits);
+            now, dir, spin, status_bits);
   bool dyna = heuristic_estimate(vm, &(session->dyna_heur_spin_observer),
-            now, src_port, init_src_port, spin);
+            now, dir, spin);
   
-  /* Now it is time to print the rtt estimates to a file */
-  /* If this is the first time we run, print CSV file header */
-  if (pkt_count == 1){
-    latency_printf(0, "%s,%s,%s", "time", "pn", "host");
-    latency_printf(0, ",%s,%s", "spin_data", "spin_new");
-    latency_printf(0, ",%s,%s", "pn_spin_data", "pn_spin_new");
-    latency_printf(0, ",%s,%s", "vec_data", "vec_new");
-    latency_printf(0, ",%s,%s", "heur_data", "heur_new");
-    latency_printf(0, "\n");
+  /* Now it is time to queue the rtt estimates for the output file */
+  latency_per_thread_t * ptd = get_per_thread(vlib_get_thread_index ());
+  /* If this is the first time we run, queue the CSV file header */
+  if (first){
+    latency_record_header(ptd, LATENCY_OUTPUT_QUIC);
   }
 
   /* If at least one update */
   if (basic || pn || status || dyna) {
-    /* Now print the actual data */
-    if (src_port == init_src_port) {
-      latency_printf(0, "%.*lf,%u,%s", TIME_PRECISION, now,
-                     packet_number, "server");
-      latency_printf(0, ",%.*lf", RTT_PRECISION, session->basic_spin_observer.rtt_server);
-      latency_printf(0, ",%d", session->basic_spin_observer.new_server);
-      latency_printf(0, ",%.*lf", RTT_PRECISION, session->pn_spin_observer.rtt_server);
-      latency_printf(0, ",%d", session->pn_spin_observer.new_server);
-      latency_printf(0, ",%.*lf", RTT_PRECISION, session->status_spin_observer.rtt_server);
-      latency_printf(0, ",%d", session->status_spin_observer.new_server);
-      latency_printf(0, ",%.*lf", RTT_PRECISION,
-             session->dyna_heur_spin_observer.rtt_server[session->dyna_heur_spin_observer.index_server]);
-      latency_printf(0, ",%d", session->dyna_heur_spin_observer.new_server);
-      latency_printf(1, "\n");
-
-      session->basic_spin_observer.new_server = false;
-      session->pn_spin_observer.new_server = false;
-      session->status_spin_observer.new_server = false;
-      session->dyna_heur_spin_observer.new_server = false;
-
-    } else {
-      latency_printf(0, "%.*lf,%u,%s", TIME_PRECISION, now,
-                     packet_number, "client");
-      latency_printf(0, ",%.*lf", RTT_PRECISION, session->basic_spin_observer.rtt_client);
-      latency_printf(0, ",%d", session->basic_spin_observer.new_client);
-      latency_printf(0, ",%.*lf", RTT_PRECISION, session->pn_spin_observer.rtt_client);
-      latency_printf(0, ",%d", session->pn_spin_observer.new_client);
-      latency_printf(0, ",%.*lf", RTT_PRECISION, session->status_spin_observer.rtt_client);
-      latency_printf(0, ",%d", session->status_spin_observer.new_client);
-      latency_printf(0, ",%.*lf", RTT_PRECISION,
-            session->dyna_heur_spin_observer.rtt_client[session->dyna_heur_spin_observer.index_client]);
-      latency_printf(0, ",%d", session->dyna_heur_spin_observer.new_client);
-      latency_printf(1, "\n");
-
-      session->basic_spin_observer.new_client = false;
-      session->pn_spin_observer.new_client = false;
-      session->status_spin_observer.new_client = false;
-      session->dyna_heur_spin_observer.new_client = false;
-    }
-  }
-}
-
-/**
- * BASIC latency estimator
- */
-bool basic_latency_estimate(vlib_main_t * vm, basic_spin_observer_t *observer,
-        f64 now, u16 src_port, u16 init_src_port, bool spin) {
-  /* if this is a packet from the SERVER */
-  if (src_port != init_src_port) {
-    if (observer->spin_server != spin) {
-      observer->spin_server = spin;
-      observer->rtt_server = now - observer->time_last_spin_server;
-      observer->new_server = true;
-      observer->time_last_spin_server = now;
-      return true;
-    }
-  /* if this is a packet from the CLIENT */
-  } else {
-    if (observer->spin_client != spin) {
-      observer->spin_client = spin;
-      observer->rtt_client = now - observer->time_last_spin_client;
-      observer->new_client = true;
-      observer->time_last_spin_client = now;
-      return true;
-    }
-  }
-  return false;
-}
-
-/*
- * (PN) observer
- */
-//TODO this does not handle PN wrap around yet
-bool pn_latency_estimate(vlib_main_t * vm, pn_spin_observer_t *observer,
-    f64 now, u16 src_port, u16 init_src_port, bool spin, u32 packet_number) {
-  /* if this is a packet from the SERVER */
-  if (src_port != init_src_port) {
-    /* check if arrived in order and has different spin */
-    if (packet_number > observer->pn_server && observer->spin_server != spin) {
-      observer->spin_server = spin;
-      observer->pn_server = packet_number;
-      observer->rtt_server = now - observer->time_last_spin_server;
-      observer->new_server = true;
-      observer->time_last_spin_server = now;
-      return true;
-    }
-  /* if this is a packet from the CLIENT */
-  } else {
-    /* check if arrived in order and has different spin */
-    if (packet_number > observer->pn_client && observer->spin_client != spin) {
-      observer->spin_client = spin;
-      observer->pn_client = packet_number;
-      observer->rtt_client = now - observer->time_last_spin_client;
-      observer->new_client = true;
-      observer->time_last_spin_client = now;
-      return true;
-    }
-  }
-  return false;
-}
-
-/*
- * VEC observer
- */
-bool status_estimate(vlib_main_t * vm, status_spin_observer_t *observer,
-      f64 now, u16 src_port, u16 init_src_port, bool spin, u8 status) {
-  bool update = false;
-  /* if this is a packet from the SERVER */
-  if (src_port != init_src_port) {
-    /* check if arrived in order and has different spin */
-    if (observer->spin_server != spin) {
-      observer->spin_server = spin;
-      /* only report and store RTT if it was valid over the entire round trip */
-      if (status == STATUS_VALID){
-        observer->rtt_server = now - observer->time_last_spin_server;
-        observer->new_server = true;
-        update = true;
-      }
-    }
-    if (status != STATUS_INVALID) observer->time_last_spin_server = now;
-  
-  /* if this is a packet from the CLIENT */
-  } else {
-    /* check if arrived in order and has different spin */
-    if (observer->spin_client != spin) {
-      observer->spin_client = spin;
-      /* only report and store RTT if it was valid over the entire round trip */
-      if (status == STATUS_VALID){
-        observer->rtt_client = now - observer->time_last_spin_client;
-        observer->new_client = true;
-        update = true;
-      }
-    }
-    if (status != STATUS_INVALID) observer->time_last_spin_client = now;
-  }
-  return update;
-}
-
-/*
- * VEC ne zero estimate
- */
-bool vec_ne_zero_estimate(vlib_main_t * vm, status_spin_observer_t *observer,
-      f64 now, u16 src_port, u16 init_src_port, bool spin, u8 status) {
-  bool update = false;
-  /* if this is a packet from the SERVER */
-  if (src_port != init_src_port) {
-    /* check if arrived in order and has different spin */
-    if (observer->spin_server != spin) {
-      observer->spin_server = spin;
-      /* only report and store RTT if it was valid over the entire round trip */
-      if (status != STATUS_INVALID){
-        observer->rtt_server = now - observer->time_last_spin_server;
-        observer->new_server = true;
-        update = true;
-      }
-    }
-    if (status != STATUS_INVALID) observer->time_last_spin_server = now;
-  
-  /* if this is a packet from the CLIENT */
-  } else {
-    /* check if arrived in order and has different spin */
-    if (observer->spin_client != spin) {
-      observer->spin_client = spin;
-      /* only report and store RTT if it was valid over the entire round trip */
-      if (status != STATUS_INVALID){
-        observer->rtt_client = now - observer->time_last_spin_client;
-        observer->new_client = true;
-        update = true;
-      }
+    /* The QUIC output always reported the estimates of the other
+     * direction (server on client packets), keep the format */
+    u8 out = !dir;
+    dyna_heur_spin_observer_t * heur = &session->dyna_heur_spin_observer;
+    u32 rtt[4] = {
+      session->basic_spin_observer.rtt[out],
+      session->pn_spin_observer.rtt[out],
+      session->status_spin_observer.rtt[out],
+      heur->rtt[out][heur->index[out]],
+    };
+    u8 new_rtt = session->basic_spin_observer.new_rtt[out]
+                 | session->pn_spin_observer.new_rtt[out] << 1
+                 | session->status_spin_observer.new_rtt[out] << 2
+                 | heur->new_rtt[out] << 3;
+    latency_record_t * rec = latency_record_sample(ptd, LATENCY_OUTPUT_QUIC,
+                &session->emit, session->flow_id, now, out, rtt, new_rtt, 4);
+
+    if (rec) {
+      rec->seq = packet_number;
+      latency_record_put(ptd);
     }
-    if (status != STATUS_INVALID) observer->time_last_spin_client = now;
-  }
-  return update;
-}
 
-/*
- * Dynamic heuristic observer
- */
-bool heuristic_estimate(vlib_main_t * vm, dyna_heur_spin_observer_t *observer,
-          f64 now, u16 src_port, u16 init_src_port, bool spin) {
-  bool update = false;
-  /* if this is a packet from the SERVER */
-  if (src_port != init_src_port) {
-    if (observer->spin_server != spin) {
-      observer->spin_server = spin;
-      f64 rtt_candidate = now - observer->time_last_spin_server;
-
-      /* calculate the acceptance threshold */
-      f64 acceptance_threshold = observer->rtt_server[0];
-      for(int i = 1; i < DYNA_HEUR_HISTORY_SIZE; i++){
-        if (observer->rtt_server[i] < acceptance_threshold){
-          acceptance_threshold = observer->rtt_server[i];
-        }
-      }
-      acceptance_threshold *= DYNA_HEUR_THRESHOLD;
-
-      if (rtt_candidate > acceptance_threshold ||
-          observer->rejected_server >= DYNA_HEUR_MAX_REJECT){
-        observer->rejected_server = 0;
-        observer->index_server =
-          (observer->index_server + 1) % DYNA_HEUR_HISTORY_SIZE;
-        observer->rtt_server[observer->index_server] = rtt_candidate;
-        observer->new_server = true;
-        update = true;
-        /* The assumption is that a packet has been held back long enough to arrive
-         * after the valid spin edge, therefore, we completely ignore this false spin edge
-         * and do not report the time at which we saw this packet */
-        observer->time_last_spin_server = now;
-
-      /* if the rtt_candidate is rejected */
-      } else {
-        observer->rejected_server++;
-      }
-    }
-  
-  /* if this is a packet from the CLIENT */
-  } else {
-    if (observer->spin_client != spin){
-      observer->spin_client = spin;
-      f64 rtt_candidate = now - observer->time_last_spin_client;
-
-      /* calculate the acceptance threshold */
-      f64 acceptance_threshold = observer->rtt_client[0];
-      for(int i = 1; i < DYNA_HEUR_HISTORY_SIZE; i++){
-        if (observer->rtt_client[i] < acceptance_threshold){
-          acceptance_threshold = observer->rtt_client[i];
-        }
-      }
-      acceptance_threshold *= DYNA_HEUR_THRESHOLD;
-
-      if (rtt_candidate > acceptance_threshold ||
-          observer->rejected_client >= DYNA_HEUR_MAX_REJECT){
-        observer->rejected_client = 0;
-        observer->index_client =
-          (observer->index_client + 1) % DYNA_HEUR_HISTORY_SIZE;
-        observer->rtt_client[observer->index_client] = rtt_candidate;
-        observer->new_client = true;
-        update = true;
-        /* see comment for packets from server */
-        observer->time_last_spin_client = now;
-      } else {
-        observer->rejected_client++;
-      }
-    }
+    session->basic_spin_observer.new_rtt[out] = false;
+    session->pn_spin_observer.new_rtt[out] = false;
+    session->status_spin_observer.new_rtt[out] = false;
+    heur->new_rtt[out] = false;
   }
-  return update;
 }
 
 /* Update all RTT estimations for TCP packets */
 void update_tcp_rtt_estimate(vlib_main_t * vm, tcp_observer_t * session,
-                f64 now, u16 src_port, u16 init_src_port, u8 measurement,
-                u32 tsval, u32 tsecr, u32 pkt_count, u32 seq_num) {
+                tcp_ts_observer_t * ts, u64 now, u8 dir, u8 measurement,
+                u32 tsval, u32 tsecr, bool first, u32 seq_num) {
+  /* Stands in for the timestamp observers of flows without TSvals */
+  static __thread tcp_ts_observer_t no_ts;
 
   bool spin = measurement & TCP_SPIN;
   u8 status_bits = (measurement & TCP_VEC_MASK) >> TCP_VEC_SHIFT;
   bool status = status_estimate(vm, &(session->status_spin_observer),
-                now, src_port, init_src_port, spin, status_bits);
+                now, dir, spin, status_bits);
   bool vec_status = vec_ne_zero_estimate(vm, &(session->vec_ne_zero),
-                now, src_port, init_src_port, spin, status_bits);
-  bool single = ts_single_estimate(vm, &(session->ts_one_RTT_observer),
-                now, src_port, init_src_port, tsval, tsecr);
-  bool all = ts_all_estimate(vm, &(session->ts_all_RTT_observer),
-                now, src_port, init_src_port, tsval, tsecr);
+                now, dir, spin, status_bits);
+  bool single = false;
+  bool all = false;
+
+  /* Timestamp observers only exist once the flow carried a TSval,
+   * print zero estimates until then */
+  if (ts) {
+    single = ts_single_estimate(vm, &(ts->ts_one_RTT_observer),
+                now, dir, tsval, tsecr);
+    all = ts_all_estimate(vm, &(ts->ts_all_RTT_observer),
+                now, dir, tsval, tsecr);
+  } else {
+    ts = &no_ts;
+  }
   
-  if (pkt_count == 1){
-    tcp_printf(0, "%s,%s,%s", "time", "host", "seq_num");
-    tcp_printf(0, ",%s,%s", "vec_data", "vec_new");
-    tcp_printf(0, ",%s,%s", "single_ts_rtt_data", "single_ts_rtt_new");
-    tcp_printf(0, ",%s,%s", "all_ts_rtt_data", "all_ts_rtt_new");
-    tcp_printf(0, ",%s,%s", "vec_ne_zero_data", "vec_ne_zero_new");
-    tcp_printf(0, "\n");
+  latency_per_thread_t * ptd = get_per_thread(vlib_get_thread_index ());
+  if (first){
+    latency_record_header(ptd, LATENCY_OUTPUT_TCP);
   }
   
   /* If we have at least one update */
   if (status || single || all || vec_status) {
-    /* Now print the actual data */
-    if (src_port != init_src_port) {
-      tcp_printf(0, "%.*lf,%s,%u", TIME_PRECISION, now, "server", seq_num);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION, session->status_spin_observer.rtt_server);
-      tcp_printf(0, ",%d", session->status_spin_observer.new_server);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION, session->ts_one_RTT_observer.rtt_server);
-      tcp_printf(0, ",%d", session->ts_one_RTT_observer.new_server);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION, session->ts_all_RTT_observer.rtt_server);
-      tcp_printf(0, ",%d", session->ts_all_RTT_observer.new_server);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION, session->vec_ne_zero.rtt_server);
-      tcp_printf(0, ",%d", session->vec_ne_zero.new_server);
-    
-      tcp_printf(1, "\n");
-
-      session->status_spin_observer.new_server = false;
-      session->vec_ne_zero.new_server = false;
-      session->ts_one_RTT_observer.new_server = false;
-      session->ts_all_RTT_observer.new_server = false;
-
-    } else {
-      tcp_printf(0, "%.*lf,%s,%u", TIME_PRECISION, now, "client", seq_num);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION, session->status_spin_observer.rtt_client);
-      tcp_printf(0, ",%d", session->status_spin_observer.new_client);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION,  session->ts_one_RTT_observer.rtt_client);
-      tcp_printf(0, ",%d", session->ts_one_RTT_observer.new_client);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION, session->ts_all_RTT_observer.rtt_client);
-      tcp_printf(0, ",%d", session->ts_all_RTT_observer.new_client);
-      tcp_printf(0, ",%.*lf", RTT_PRECISION, session->vec_ne_zero.rtt_client);
-      tcp_printf(0, ",%d", session->vec_ne_zero.new_client);
-      
-      tcp_printf(1, "\n");
-
-      session->status_spin_observer.new_client = false;
-      session->vec_ne_zero.new_client = false;
-      session->ts_one_RTT_observer.new_client = false;
-      session->ts_all_RTT_observer.new_client = false;
-
+    /* Now queue the actual data */
+    u32 rtt[4] = {
+      session->status_spin_observer.rtt[dir],
+      ts->ts_one_RTT_observer.rtt[dir],
+      ts->ts_all_RTT_observer.rtt[dir],
+      session->vec_ne_zero.rtt[dir],
+    };
+    u8 new_rtt = session->status_spin_observer.new_rtt[dir]
+                 | ts->ts_one_RTT_observer.new_rtt[dir] << 1
+                 | ts->ts_all_RTT_observer.new_rtt[dir] << 2
+                 | session->vec_ne_zero.new_rtt[dir] << 3;
+    latency_record_t * rec = latency_record_sample(ptd, LATENCY_OUTPUT_TCP,
+                &session->emit, session->flow_id, now, dir, rtt, new_rtt, 4);
+
+    if (rec) {
+      rec->seq = seq_num;
+      latency_record_put(ptd);
     }
+
+    session->status_spin_observer.new_rtt[dir] = false;
+    session->vec_ne_zero.new_rtt[dir] = false;
+    ts->ts_one_RTT_observer.new_rtt[dir] = false;
+    ts->ts_all_RTT_observer.new_rtt[dir] = false;
   }
 }
 
 /* One RTT estimation per RTT */
 bool ts_single_estimate(vlib_main_t * vm,
           timestamp_observer_single_RTT_t * observer,
-          f64 now, u16 src_port, u16 init_src_port, u32 tsval, u32 tsecr) {
+          u64 now, u8 dir, u32 tsval, u32 tsecr) {
+  u8 peer = !dir;
   bool update = false;
-  if (src_port == init_src_port) {
-    if (!observer->ts_init_client) {
-      observer->ts_init_client = tsval;
-      observer->time_init_client = now;
-    } else {  
-      if (tsecr && observer->ts_ack_client &&
-          tsecr >= observer->ts_ack_client) {
-        observer->rtt_client = now - observer->time_init_client;
-        observer->ts_init_client = tsval;
-        observer->ts_ack_client = 0;
-        observer->time_init_client = now;
-        observer->new_client = true;
-        update = true;
-      }
-    }
-    if (tsecr && !observer->ts_ack_server &&
-        tsecr >= observer->ts_init_server) { 
-      observer->ts_ack_server = tsval;
+
+  if (!observer->ts_init[dir]) {
+    observer->ts_init[dir] = tsval;
+    observer->time_init[dir] = now;
+  } else {  
+    if (tsecr && observer->ts_ack[dir] &&
+        tsecr >= observer->ts_ack[dir]) {
+      observer->rtt[dir] = latency_rtt_us(now, observer->time_init[dir]);
+      observer->ts_init[dir] = tsval;
+      observer->ts_ack[dir] = 0;
+      observer->time_init[dir] = now;
+      observer->new_rtt[dir] = true;
+      update = true;
     }
   }
-  else {
-    if (!observer->ts_init_server) {
-      observer->ts_init_server = tsval;
-      observer->time_init_server = now;
+  if (tsecr && !observer->ts_ack[peer] &&
+      tsecr >= observer->ts_init[peer]) { 
+    observer->ts_ack[peer] = tsval;
+  }
+  return update;
+}
+
+/* Slot of a timestamp in a latency_ts_table_t */
+always_inline u32 ts_table_hash(u32 ts) {
+  /* Fibonacci hashing, the low TSval bits change fastest */
+  return (ts * 2654435761u) >> (32 - min_log2 (LATENCY_TS_ENTRIES));
+}
+
+/* Index of ts in the table, ~0 if not present */
+always_inline u32 ts_table_find(latency_ts_table_t * t, u32 ts) {
+  u32 h = ts_table_hash(ts);
+  u32 i, j;
+
+  for (i = 0; i < LATENCY_TS_WAYS; i++) {
+    j = (h + i) & (LATENCY_TS_ENTRIES - 1);
+    if ((t->valid & (1ULL << j)) && t->ts[j] == ts) {
+      return j;
     }
-    else {
-      if (tsecr && observer->ts_ack_server &&
-          tsecr >= observer->ts_ack_server) {
-        observer->rtt_server = now - observer->time_init_server;
-        observer->ts_init_server = tsval;
-        observer->ts_ack_server = 0;
-        observer->time_init_server = now;
-        observer->new_server = true;
-        update = true;
+  }
+  return ~0;
+}
+
+/* Add or update ts. If the probe window is full, ts is dropped: evicting
+ * a TSval still waiting for its echo would lose that sample as well. Only
+ * an entry older than LATENCY_TS_MAX_AGE is given up for ts. */
+always_inline void ts_table_set(latency_ts_table_t * t, u32 ts, u64 time,
+                                u64 now) {
+  u32 h = ts_table_hash(ts);
+  u32 i, j, slot = ~0, oldest = ~0;
+
+  for (i = 0; i < LATENCY_TS_WAYS; i++) {
+    j = (h + i) & (LATENCY_TS_ENTRIES - 1);
+    if (t->valid & (1ULL << j)) {
+      if (t->ts[j] == ts) {
+        slot = j;
+        break;
+      }
+      if (oldest == ~0 || t->time[j] < t->time[oldest]) {
+        oldest = j;
       }
+    } else if (slot == ~0) {
+      slot = j;
     }
-    if (tsecr && !observer->ts_ack_client &&
-        tsecr >= observer->ts_init_client) {
-      observer->ts_ack_client = tsval;
-    } 
   }
-  return update;
+  if (slot == ~0) {
+    if (now - t->time[oldest] < LATENCY_TS_MAX_AGE) {
+      return;
+    }
+    slot = oldest;
+  }
+
+  t->ts[slot] = ts;
+  t->time[slot] = time;
+  t->valid |= 1ULL << slot;
+}
+
+always_inline void ts_table_del(latency_ts_table_t * t, u32 i) {
+  t->valid &= ~(1ULL << i);
 }
 
-/* RTT estimation for every possible timestamp value */
+/* RTT estimation for every possible timestamp value
+ * The outstanding timestamps are kept in fixed size tables, if they are
+ * full new TSvals are dropped instead of growing the state.
+ * own are the tables of the sender, peer the ones of the other direction */
 bool ts_all_estimate(vlib_main_t * vm, timestamp_observer_all_RTT_t * observer,
-          f64 now, u16 src_port, u16 init_src_port, u32 tsval, u32 tsecr) {
+          u64 now, u8 dir, u32 tsval, u32 tsecr) {
+  latency_ts_table_t * init_own = &observer->init[dir];
+  latency_ts_table_t * ack_own = &observer->ack[dir];
+  latency_ts_table_t * init_peer = &observer->init[!dir];
+  latency_ts_table_t * ack_peer = &observer->ack[!dir];
   bool update = false;
-
-  // TODO state will explode in case of large reordering
-  if (src_port == init_src_port) {
-    uword* init_t = hash_get(observer->hash_init_client, tsval);
-    uword* ack_t = hash_get(observer->hash_ack_client, tsecr);
-    uword* init_t_server = hash_get(observer->hash_init_server, tsecr);
-    if (!init_t) {
-      time_test_t* temp;
-      vec_alloc(temp, 1);
-      memset(temp, 0, sizeof (time_test_t));
-      temp->time = now;
-      hash_set(observer->hash_init_client, tsval, temp);
-    } 
-    if (tsecr && ack_t) {
-      time_test_t* ack_time = (time_test_t *) ack_t[0];
-      observer->rtt_client = now - ack_time->time;
-      vec_free(ack_time);
-      hash_unset(observer->hash_ack_client, tsecr);
-      observer->new_client = true;
-      update = true;
-    }
-    if (tsecr && init_t_server) {
-      hash_set(observer->hash_ack_server, tsval, (time_test_t*) init_t_server[0]);
-      hash_unset(observer->hash_init_server, tsecr);
-    }
+  u32 i;
+
+  /* Remember when the TSval was sent first. Packets sent after its echo
+   * may carry it as well, they must not add it again: these entries would
+   * never be echoed */
+  if (!observer->tsval_seen[dir]
+      || (i32) (tsval - observer->tsval_last[dir]) > 0) {
+    ts_table_set(init_own, tsval, now, now);
+    observer->tsval_last[dir] = tsval;
+    observer->tsval_seen[dir] = true;
   }
-  else {
-    uword* init_t = hash_get(observer->hash_init_server, tsval);
-    uword* ack_t = hash_get(observer->hash_ack_server, tsecr);
-    uword* init_t_client = hash_get(observer->hash_init_client, tsecr);
-    if (!init_t) {
-      time_test_t* temp;
-      vec_alloc(temp, 1);
-      memset(temp, 0, sizeof (time_test_t));
-      temp->time = now;
-      hash_set(observer->hash_init_server, tsval, temp);
-    } 
-    if (tsecr && ack_t) {
-      time_test_t* ack_time = (time_test_t *) ack_t[0];
-      observer->rtt_server = now - ack_time->time;
-      vec_free(ack_time);
-      hash_unset(observer->hash_ack_server, tsecr);
-      observer->new_server = true;
+
+  if (tsecr) {
+    /* Echo of a TSval the peer sent as echo of one of ours: one RTT */
+    i = ts_table_find(ack_own, tsecr);
+    if (i != ~0) {
+      observer->rtt[dir] = latency_rtt_us(now, ack_own->time[i]);
+      ts_table_del(ack_own, i);
+      observer->new_rtt[dir] = true;
       update = true;
     }
-    if (tsecr && init_t_client) { 
-      hash_set(observer->hash_ack_client, tsval, (time_test_t*) init_t_client[0]);
-      hash_unset(observer->hash_init_client, tsecr);
+
+    /* Echo of a TSval of the peer, wait for the echo of our TSval */
+    i = ts_table_find(init_peer, tsecr);
+    if (i != ~0) {
+      ts_table_set(ack_peer, tsval, init_peer->time[i], now);
+      ts_table_del(init_peer, i);
     }
   }
-  // TODO: check all hash sizes and clear if too big
-  // perhaps also based on amount of observed packets, e.g. every 5000 packets
-  // E.g. if sum(4 hashes) > 500 -> clear all hashes,
-  // set both times to 0 and update to true
   return update;
 }
 
 void update_plus_rtt_estimate(vlib_main_t * vm, plus_observer_t * session,
-        f64 now, u16 src_port, u16 init_src_port, u32 psn,
-        u32 pse, u64 cat, u32 pkt_count) {
+        u64 now, u8 dir, u32 psn, u32 pse, u64 cat, u32 pkt_count) {
   
   bool new_rtt = psn_single_estimate(vm, &(session->plus_single_observer),
-                 src_port, init_src_port, psn, pse, now);
+                 dir, psn, pse, now);
   
+  latency_per_thread_t * ptd = get_per_thread(vlib_get_thread_index ());
   if (pkt_count == 1){
     /* TODO: add CAT */
-    plus_printf(0, "%s,%s,%s,%s,%s,%s", "time", "host", "#pkt", "psn", "pse", "cat");
-    plus_printf(0, ",%s,%s", "psn_pse_data", "psn_pse_new");
-    plus_printf(0, "\n");
+    latency_record_header(ptd, LATENCY_OUTPUT_PLUS);
   }
 
   /* If we have at least one update */
   if (new_rtt) {
-    /* Now print the actual data */
-    if (src_port != init_src_port) {
-      plus_printf(0, "%.*lf,%s,%u,%u,%u,%llu", TIME_PRECISION, now, "server", pkt_count, psn, pse, cat);
-      
-      plus_printf(0, ",%.*lf", RTT_PRECISION, session->plus_single_observer.rtt_dst);
-      plus_printf(0, ",%d", session->plus_single_observer.new_server);
-    
-      plus_printf(1, "\n");
-
-      session->plus_single_observer.new_server = false;
-    } else {
-      plus_printf(0, "%.*lf,%s,%u,%u,%u,%llu", TIME_PRECISION, now, "client", pkt_count, psn, pse, cat);
-      
-      plus_printf(0, ",%.*lf", RTT_PRECISION, session->plus_single_observer.rtt_src);
-      plus_printf(0, ",%d", session->plus_single_observer.new_client);
-      
-      plus_printf(1, "\n");
-
-      session->plus_single_observer.new_client = false;
+    /* Now queue the actual data */
+    u32 rtt = session->plus_single_observer.rtt[dir];
+    latency_record_t * rec = latency_record_sample(ptd, LATENCY_OUTPUT_PLUS,
+                &session->emit, session->flow_id, now, dir, &rtt,
+                session->plus_single_observer.new_rtt[dir], 1);
+
+    if (rec) {
+      rec->seq = pkt_count;
+      rec->psn = psn;
+      rec->pse = pse;
+      rec->cat = cat;
+      latency_record_put(ptd);
     }
+
+    session->plus_single_observer.new_rtt[dir] = false;
   }
 }
 
 bool psn_single_estimate(vlib_main_t * vm, plus_single_observer_t * session,
-        u16 src_port, u16 init_src_port, u32 psn, u32 pse, f64 now) {
-    /* Decide direction */
-  if (src_port == init_src_port) {
-    /* Is the RTT estimation for the last packet completed?  */ 
-    if (session->time_src == 0) {
-      session->psn_src = psn;
-      session->time_src = now;
-    }
-    if (session->time_dst && comes_after_u32(pse, session->psn_dst)) {
-      session->rtt_src = now - session->time_dst;
-      session->time_dst = 0;
-      session->new_client = true;
-      return true;
-    }
-  } else {
-    if (session->time_dst == 0) {
-      session->psn_dst = psn;
-      session->time_dst = now;
-    }
-    if (session->time_src && comes_after_u32(pse, session->psn_src)) {
-      session->rtt_dst = now - session->time_src;
-      session->time_src = 0;
-      session->new_server = true;
-      return true;
-    }
+        u8 dir, u32 psn, u32 pse, u64 now) {
+  u8 peer = !dir;
+
+  /* Is the RTT estimation for the last packet completed?  */ 
+  if (session->time[dir] == 0) {
+    session->psn[dir] = psn;
+    session->time[dir] = now;
+  }
+  if (session->time[peer] && comes_after_u32(pse, session->psn[peer])) {
+    session->rtt[dir] = latency_rtt_us(now, session->time[peer]);
+    session->time[peer] = 0;
+    session->new_rtt[dir] = true;
+    return true;
   }
   return false;
 }
@@ -962,68 +888,65 @@ bool psn_single_estimate(vlib_main_t * vm, plus_single_observer_t * session,
 /**
  * @brief update the state of the session with the given key
  */
-void update_state(latency_key_t * kv_in, uword new_state)
+int update_state(latency_per_thread_t * ptd, latency_key_t * kv_in,
+                  uword new_state)
 {
   BVT(clib_bihash_kv) kv;
-  latency_main_t *pm = &latency_main;
   BVT(clib_bihash) *bi_table;
-  bi_table = &pm->latency_table;
-  kv.key = kv_in->as_u64;
+  bi_table = &ptd->latency_table;
+  clib_memcpy (kv.key, kv_in->as_u64, sizeof (kv.key));
+  kv.value = new_state;
+  return BV(clib_bihash_add_del) (bi_table, &kv, 1 /* is_add */);
+}
+
+/**
+ * @brief update the state of the session with the given IPv6 key
+ */
+int update_state6(latency_per_thread_t * ptd, latency_key6_t * kv_in,
+                   uword new_state)
+{
+  clib_bihash_kv_48_8_t kv;
+  clib_memcpy (kv.key, kv_in->as_u64, sizeof (kv.key));
   kv.value = new_state;
-  BV(clib_bihash_add_del) (bi_table, &kv, 1 /* is_add */);
+  return clib_bihash_add_del_48_8 (&ptd->latency_table6, &kv, 1 /* is_add */);
 }
 
 /**
  * @brief create a new session for a new flow
+ *
+ * The observers are only created once the flow carries a signal, see
+ * create_quic_observer() and friends.
+ * The session is counted by the caller once its keys are added, see
+ * latency_count_session().
+ * Returns ~0 if the thread already has max_sessions sessions.
  */
-u32 create_session(sup_protocols_t p_type) {
+u32 create_session(latency_per_thread_t * ptd, sup_protocols_t p_type) {
   latency_session_t * session;
-  latency_main_t * pm = &latency_main;
-  pm->active_flows ++;
-  pm->total_flows ++;
-  pool_get (pm->session_pool, session);
+
+  if (pool_elts (ptd->session_pool) >= latency_main.max_sessions) {
+    return ~0;
+  }
+  pool_get_aligned (ptd->session_pool, session, CLIB_CACHE_LINE_BYTES);
   memset(session, 0, sizeof (*session));
   /* Correct session index */
-  session->index = session - pm->session_pool;
+  session->index = session - ptd->session_pool;
+  vec_validate (ptd->session_cold, session->index);
+  memset(get_latency_session_cold(ptd, session), 0,
+         sizeof (latency_session_cold_t));
   session->state = 0;
+  session->observer_index = ~0;
   
   switch (p_type) {
     case P_TCP:
       session->p_type = P_TCP;
-      vec_alloc(session->tcp, 1);
-      memset(session->tcp, 0, sizeof (tcp_observer_t));
-      session->tcp->status_spin_observer.spin_client = SPIN_NOT_KNOWN;
-      session->tcp->status_spin_observer.spin_server = SPIN_NOT_KNOWN;
-      session->tcp->vec_ne_zero.spin_client = SPIN_NOT_KNOWN;
-      session->tcp->vec_ne_zero.spin_server = SPIN_NOT_KNOWN;
-      session->tcp->ts_all_RTT_observer.hash_init_client =
-        hash_create(0, sizeof(time_test_t*));
-      session->tcp->ts_all_RTT_observer.hash_init_server =
-        hash_create(0, sizeof(time_test_t*));
-      session->tcp->ts_all_RTT_observer.hash_ack_client =
-        hash_create(0, sizeof(time_test_t*));
-      session->tcp->ts_all_RTT_observer.hash_ack_server =
-        hash_create(0, sizeof(time_test_t*));
       break;
 
     case P_QUIC:
       session->p_type = P_QUIC;
-      vec_alloc(session->quic, 1);
-      memset(session->quic, 0, sizeof (quic_observer_t));
-      session->quic->basic_spin_observer.spin_client = SPIN_NOT_KNOWN;
-      session->quic->basic_spin_observer.spin_server = SPIN_NOT_KNOWN;
-      session->quic->pn_spin_observer.spin_client = SPIN_NOT_KNOWN;
-      session->quic->pn_spin_observer.spin_server = SPIN_NOT_KNOWN;
-      session->quic->status_spin_observer.spin_client = SPIN_NOT_KNOWN;
-      session->quic->status_spin_observer.spin_server = SPIN_NOT_KNOWN;
-      session->quic->dyna_heur_spin_observer.spin_client = SPIN_NOT_KNOWN;
-      session->quic->dyna_heur_spin_observer.spin_server = SPIN_NOT_KNOWN;
     break;
 
     case P_PLUS:
       session->p_type = P_PLUS;
-      vec_alloc(session->plus, 1);
-      memset(session->plus, 0, sizeof (plus_observer_t));
     break;
     
     case P_UNKNOWN:
@@ -1035,62 +958,249 @@ u32 create_session(sup_protocols_t p_type) {
   return session->index;
 }
 
+/**
+ * @brief create the observer of a QUIC session (first spin signal)
+ */
+quic_observer_t * create_quic_observer(latency_per_thread_t * ptd,
+        latency_session_t * session) {
+  quic_observer_t * quic;
+
+  pool_get_aligned(ptd->quic_pool, quic, CLIB_CACHE_LINE_BYTES);
+  memset(quic, 0, sizeof (*quic));
+  session->observer_index = quic - ptd->quic_pool;
+  quic->flow_id = latency_flow_id(ptd);
+  quic->emit.summary_index = ~0;
+  quic->basic_spin_observer.spin[LATENCY_DIR_CLIENT] = SPIN_NOT_KNOWN;
+  quic->basic_spin_observer.spin[LATENCY_DIR_SERVER] = SPIN_NOT_KNOWN;
+  quic->pn_spin_observer.spin[LATENCY_DIR_CLIENT] = SPIN_NOT_KNOWN;
+  quic->pn_spin_observer.spin[LATENCY_DIR_SERVER] = SPIN_NOT_KNOWN;
+  quic->status_spin_observer.spin[LATENCY_DIR_CLIENT] = SPIN_NOT_KNOWN;
+  quic->status_spin_observer.spin[LATENCY_DIR_SERVER] = SPIN_NOT_KNOWN;
+  quic->dyna_heur_spin_observer.spin[LATENCY_DIR_CLIENT] = SPIN_NOT_KNOWN;
+  quic->dyna_heur_spin_observer.spin[LATENCY_DIR_SERVER] = SPIN_NOT_KNOWN;
+  return quic;
+}
+
+/**
+ * @brief create the observer of a TCP session (first VEC bits or TSval)
+ */
+tcp_observer_t * create_tcp_observer(latency_per_thread_t * ptd,
+        latency_session_t * session) {
+  tcp_observer_t * tcp;
+
+  pool_get_aligned(ptd->tcp_pool, tcp, CLIB_CACHE_LINE_BYTES);
+  memset(tcp, 0, sizeof (*tcp));
+  session->observer_index = tcp - ptd->tcp_pool;
+  tcp->flow_id = latency_flow_id(ptd);
+  tcp->emit.summary_index = ~0;
+  tcp->status_spin_observer.spin[LATENCY_DIR_CLIENT] = SPIN_NOT_KNOWN;
+  tcp->status_spin_observer.spin[LATENCY_DIR_SERVER] = SPIN_NOT_KNOWN;
+  tcp->vec_ne_zero.spin[LATENCY_DIR_CLIENT] = SPIN_NOT_KNOWN;
+  tcp->vec_ne_zero.spin[LATENCY_DIR_SERVER] = SPIN_NOT_KNOWN;
+  tcp->ts_index = ~0;
+  return tcp;
+}
+
+/**
+ * @brief create the timestamp observers of a TCP observer (first TSval)
+ */
+tcp_ts_observer_t * create_tcp_ts_observer(latency_per_thread_t * ptd,
+        tcp_observer_t * tcp) {
+  tcp_ts_observer_t * ts;
+
+  pool_get_aligned(ptd->tcp_ts_pool, ts, CLIB_CACHE_LINE_BYTES);
+  memset(ts, 0, sizeof (*ts));
+  tcp->ts_index = ts - ptd->tcp_ts_pool;
+  return ts;
+}
+
+/**
+ * @brief create the observer of a PLUS session (first PLUS header)
+ */
+plus_observer_t * create_plus_observer(latency_per_thread_t * ptd,
+        latency_session_t * session) {
+  plus_observer_t * plus;
+
+  pool_get_aligned(ptd->plus_pool, plus, CLIB_CACHE_LINE_BYTES);
+  memset(plus, 0, sizeof (*plus));
+  session->observer_index = plus - ptd->plus_pool;
+  plus->flow_id = latency_flow_id(ptd);
+  plus->emit.summary_index = ~0;
+  return plus;
+}
+
+/**
+ * @brief RTT quantile (permille) of a flow summary
+ *
+ * Upper bound of the histogram bucket of the quantile, within the
+ * observed min and max.
+ */
+static u32 latency_summary_quantile(latency_rtt_summary_t * a, u32 permille) {
+  u64 rank = ((u64) a->n_samples * permille + 999) / 1000;
+  u64 seen = 0;
+  u32 b, k, upper;
+
+  for (b = 0; b < LATENCY_SUMMARY_BUCKETS - 1; b++) {
+    seen += a->hist[b];
+    if (seen >= rank) {
+      break;
+    }
+  }
+  k = b / 2;
+  upper = b & 1 ? 2 << k : (3 << k) >> 1;
+  return clib_max (a->min, clib_min (upper, a->max));
+}
+
+/**
+ * @brief queue the summary records of a flow and free its aggregates
+ *
+ * One record per estimator and direction with samples.
+ */
+static void latency_summary_close(latency_per_thread_t * ptd,
+        latency_emit_t * emit, u64 flow_id, latency_output_t output) {
+  latency_summary_t * sum;
+  latency_rtt_summary_t * a;
+  latency_record_t * rec;
+  u32 dir, i;
+
+  if (emit->summary_index == ~0) {
+    return;
+  }
+  sum = pool_elt_at_index (ptd->summary_pool, emit->summary_index);
+
+  for (dir = 0; dir < 2; dir++) {
+    for (i = 0; i < LATENCY_STATS_N_ESTIMATORS; i++) {
+      a = &sum->rtt[dir][i];
+      if (!a->n_samples) {
+        continue;
+      }
+      rec = latency_record_get(ptd, output);
+      if (!rec) {
+        continue;
+      }
+      rec->is_summary = 1;
+      rec->flow_id = flow_id;
+      rec->time = sum->time_first;
+      rec->dir = dir;
+      rec->estimator = i;
+      rec->duration = sum->time_last - sum->time_first;
+      rec->n_samples = a->n_samples;
+      rec->rtt_min = a->min;
+      rec->rtt_mean = a->sum / a->n_samples;
+      rec->rtt_max = a->max;
+      rec->rtt_p50 = latency_summary_quantile(a, 500);
+      rec->rtt_p99 = latency_summary_quantile(a, 990);
+      latency_record_put(ptd);
+    }
+  }
+
+  pool_put_index (ptd->summary_pool, emit->summary_index);
+  emit->summary_index = ~0;
+}
+
+/**
+ * @brief undo create_session() if the keys of the session can not be added
+ *
+ * Such a session has no timer, no observer, is not counted and not in the
+ * stats yet. Only the forward key (key_added) may be in the flow table.
+ */
+void abort_session(latency_per_thread_t * ptd, latency_session_t * session,
+                   int key_added)
+{
+  if (key_added) {
+    BVT(clib_bihash_kv) kv;
+    latency_session_cold_t * cold = get_latency_session_cold(ptd, session);
+    clib_memcpy (kv.key, cold->key.as_u64, sizeof (kv.key));
+    BV(clib_bihash_add_del) (&ptd->latency_table, &kv, 0 /* is_add */);
+  }
+  pool_put (ptd->session_pool, session);
+}
+
 /**
  * @brief clean session after timeout
+ *
+ * Returns 1 if the session was cleaned, 0 if it was already gone.
  */
-void clean_session(u32 index)
+int clean_session(latency_per_thread_t * ptd, u32 index)
 {
-  latency_main_t * pm = &latency_main;
-  latency_session_t * session = get_latency_session(index);
+  latency_session_t * session = get_latency_session(ptd, index);
   
   /* If main loop (in node.c) is executed sparsely, it can happen that
    * the timer wheel triggers multiple times for the same session.
    * We remove/clean the session only the first time. */
   if (session == 0) {
-    return;
+    return 0;
   }
-  pm->active_flows --;
+  latency_count_session(ptd, session, -1);
+  latency_stats_session_close(ptd, session);
  
+  /* Observers only exist if the flow carried a signal */
   switch (session->p_type) {
     case P_TCP:
-      // TODO: fix potential memory leak
-      // Iterate over all remaining key, value pairs and free value pointers
-      hash_free(session->tcp->ts_all_RTT_observer.hash_init_client);
-      hash_free(session->tcp->ts_all_RTT_observer.hash_init_server);
-      hash_free(session->tcp->ts_all_RTT_observer.hash_ack_client);
-      hash_free(session->tcp->ts_all_RTT_observer.hash_ack_server);
-      vec_free(session->tcp);
+      if (session->observer_index != ~0) {
+        tcp_observer_t * tcp = latency_tcp(ptd, session);
+        latency_summary_close(ptd, &tcp->emit, tcp->flow_id,
+                              LATENCY_OUTPUT_TCP);
+        if (tcp->ts_index != ~0) {
+          pool_put_index(ptd->tcp_ts_pool, tcp->ts_index);
+        }
+        pool_put(ptd->tcp_pool, tcp);
+      }
     break;
 
     case P_QUIC:
-      vec_free(session->quic);
+      if (session->observer_index != ~0) {
+        quic_observer_t * quic = latency_quic(ptd, session);
+        latency_summary_close(ptd, &quic->emit, quic->flow_id,
+                              LATENCY_OUTPUT_QUIC);
+        pool_put(ptd->quic_pool, quic);
+      }
     break;
 
     case P_PLUS:
-      vec_free(session->plus);
+      if (session->observer_index != ~0) {
+        plus_observer_t * plus = latency_plus(ptd, session);
+        latency_summary_close(ptd, &plus->emit, plus->flow_id,
+                              LATENCY_OUTPUT_PLUS);
+        pool_put(ptd->plus_pool, plus);
+      }
     break;
 
     default:
       break;
   }
 
-  BVT(clib_bihash_kv) kv;
-  BVT(clib_bihash) * bi_table;
-  bi_table = &pm->latency_table;
-  
   /* Clear hash and pool entry
-   * First for the key in reverse direction */
-  kv.key = session->key_reverse;
-  BV(clib_bihash_add_del) (bi_table, &kv, 0 /* is_add */);
-  kv.key = session->key;
-  BV(clib_bihash_add_del) (bi_table, &kv, 0 /* is_add */);
-  pool_put (pm->session_pool, session);
+   * IPv6 and passive mode sessions only have a single key */
+  latency_session_cold_t * cold = get_latency_session_cold(ptd, session);
+  if (session->is_ip6) {
+    clib_bihash_kv_48_8_t kv6;
+    clib_memcpy (kv6.key, cold->key6.as_u64, sizeof (kv6.key));
+    clib_bihash_add_del_48_8 (&ptd->latency_table6, &kv6, 0 /* is_add */);
+  } else {
+    BVT(clib_bihash_kv) kv;
+    BVT(clib_bihash) * bi_table;
+    bi_table = &ptd->latency_table;
+
+    /* First for the key in reverse direction */
+    if (session->new_dst_ip) {
+      clib_memcpy (kv.key, cold->key_reverse.as_u64, sizeof (kv.key));
+      BV(clib_bihash_add_del) (bi_table, &kv, 0 /* is_add */);
+    }
+    clib_memcpy (kv.key, cold->key.as_u64, sizeof (kv.key));
+    BV(clib_bihash_add_del) (bi_table, &kv, 0 /* is_add */);
+  }
+  pool_put (ptd->session_pool, session);
+  return 1;
 }
 
 /**
  * @brief callback function for expired timer
+ *
+ * Called from expire_timers() on the thread owning the timer wheel.
  */
 static void timer_expired_callback(u32 * expired_timers) {
+  latency_per_thread_t * ptd = get_per_thread(vlib_get_thread_index ());
   int i;
   u32 index, timer_id;
   
@@ -1103,7 +1213,7 @@ static void timer_expired_callback(u32 * expired_timers) {
     /* Only use timer with ID 0 at the moment */
     ASSERT (timer_id == 0);
 
-    clean_session(index);
+    ptd->n_expired += clean_session(ptd, index);
   }
 }
 
@@ -1166,75 +1276,6 @@ tcp_options_parse_mod (tcp_header_t * th, u32 * tsval, u32 * tsecr) {
   return 0;
 }    
 
-/* Output to CLI / stdout, this is a modified copy of `vlib_cli_output` */
-void latency_printf (int flush, char *fmt, ...) {
-  va_list va;
-  u8 *s;
-
-  static FILE *output_file_spin = NULL;
-
-  va_start (va, fmt);
-  s = va_format (0, fmt, &va);
-  va_end (va);
-
-  if (output_file_spin == NULL){
-    output_file_spin = fopen("/tmp/latency_quic_printf.out", "w");
-  }
-  fprintf(output_file_spin, "%s", s);
-
-  if (flush){
-    fflush(output_file_spin);
-  }
-
-  vec_free (s);
-}
-
-/* Output to CLI / stdout, this is a modified copy of `vlib_cli_output` */
-void tcp_printf (int flush, char *fmt, ...) {
-  va_list va;
-  u8 *s;
-
-  static FILE *output_file_tcp = NULL;
-
-  va_start (va, fmt);
-  s = va_format (0, fmt, &va);
-  va_end (va);
-
-  if (output_file_tcp == NULL){
-    output_file_tcp = fopen("/tmp/latency_tcp_printf.out", "w");
-  }
-  fprintf(output_file_tcp, "%s", s);
-
-  if (flush){
-    fflush(output_file_tcp);
-  }
-
-  vec_free (s);
-}
-
-/* Output to CLI / stdout, this is a modified copy of `vlib_cli_output` */
-void plus_printf (int flush, char *fmt, ...) {
-  va_list va;
-  u8 *s;
-
-  static FILE *output_file_plus = NULL;
-
-  va_start (va, fmt);
-  s = va_format (0, fmt, &va);
-  va_end (va);
-
-  if (output_file_plus == NULL){
-    output_file_plus = fopen("/tmp/latency_plus_printf.out", "w");
-  }
-  fprintf(output_file_plus, "%s", s);
-
-  if (flush){
-    fflush(output_file_plus);
-  }
-
-  vec_free (s);
-}
-
 /**
  * @brief Initialize the latency plugin.
  */
@@ -1244,8 +1285,13 @@ static clib_error_t * latency_init (vlib_main_t * vm)
   // TODO: set mb_IP to good default value!!!
 
   latency_main_t * pm = &latency_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  latency_per_thread_t * ptd;
+  vlib_thread_registration_t * tr;
   clib_error_t * error = 0;
   u8 * name;
+  uword * p;
+  u32 i;
 
   pm->vnet_main =  vnet_get_main ();
   name = format (0, "latency_%08x%c", api_version, 0);
@@ -1259,26 +1305,53 @@ static clib_error_t * latency_init (vlib_main_t * vm)
   /* Add our API messages to the global name_crc hash table */
   setup_message_id_table (pm, &api_main);
  
-  /* Create hashes */
-  pm->hash_quic_ports = hash_create(0, sizeof(u16));
+  /* Create port bitmaps and hashes */
+  clib_bitmap_validate(pm->quic_port_bitmap, 1 << 16);
+  clib_bitmap_validate(pm->nat_port_bitmap, 1 << 16);
 
   pm->hash_server_ports_to_ips = hash_create(0, sizeof(u32));
 
-  /* Init bihash */
-  BV (clib_bihash_init) (&pm->latency_table, "latency", 2048, 512<<20);
+  /* One set of flow state per thread (main thread and workers) */
+  vec_validate_aligned (pm->per_thread, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
 
-  /* Timer wheel has 2048 slots, so we predefine pool with
-   * 2048 entries as well */ 
-  pool_init_fixed(pm->session_pool, 2048);
+  vec_foreach (ptd, pm->per_thread) {
+    ptd->thread_index = ptd - pm->per_thread;
+  }
 
-  /* Init timer wheel with 100ms resolution */
-  tw_timer_wheel_init_2t_1w_2048sl (&pm->tw,
-          timer_expired_callback, 100e-3, ~0);
-  pm->tw.last_run_time = vlib_time_now (vm);
-  
-  /* Set counters to zero*/
-  pm->total_flows = 0;
-  pm->active_flows = 0;
+  /* Capacity defaults, the tables are created by latency_config */
+  pm->max_sessions = LATENCY_DEFAULT_MAX_SESSIONS;
+  pm->hash_buckets = LATENCY_DEFAULT_HASH_BUCKETS;
+  pm->hash_memory = LATENCY_DEFAULT_HASH_MEMORY;
+  pm->timer_tick = LATENCY_DEFAULT_TIMER_TICK;
+  pm->ring_size = LATENCY_DEFAULT_RING_SIZE;
+  pm->log_segment_size = LATENCY_DEFAULT_LOG_SEGMENT_SIZE;
+
+  /* Flow counters, one set per thread */
+  pm->counters.name = "latency";
+  vlib_validate_simple_counter (&pm->counters, LATENCY_N_COUNTER - 1);
+  for (i = 0; i < LATENCY_N_COUNTER; i++) {
+    vlib_zero_simple_counter (&pm->counters, i);
+  }
+
+  /* Workers for the flow handoff */
+  pm->first_worker_index = 0;
+  pm->num_workers = 0;
+  pm->fq_index = ~0;
+  pm->fq_index6 = ~0;
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  if (p) {
+    tr = (vlib_thread_registration_t *) p[0];
+    if (tr) {
+      pm->num_workers = tr->count;
+      pm->first_worker_index = tr->first_index;
+    }
+  }
+  pm->error_drop_node_index =
+    vlib_get_node_by_name (vm, (u8 *) "error-drop")->index;
+
+  pm->housekeeping_interval = LATENCY_HOUSEKEEPING_INTERVAL;
+  pm->passive = 0;
 
   vec_free(name);
 
@@ -1287,6 +1360,113 @@ static clib_error_t * latency_init (vlib_main_t * vm)
 
 VLIB_INIT_FUNCTION (latency_init);
 
+/**
+ * @brief Parse the latency startup config section and create the flow
+ * state of all threads.
+ *
+ * latency {
+ *   max-sessions <n>     sessions per thread (default 65536)
+ *   hash-buckets <n>     buckets of each flow table (default 16384)
+ *   hash-memory <size>   memory of each flow table (default 64M)
+ *   timer-tick <ms>      timer wheel resolution (default 100)
+ *
+ * Every thread has an IPv4 and an IPv6 flow table, so the flow tables map
+ * up to 2 * threads * hash-memory. The number of timer wheel slots is
+ * fixed by the timer template, so the tick is set instead.
+ *   output-ring <n>      output records per thread (default 16384)
+ *   log-segment-size <size>  size of the binary log segments (default 64M)
+ * }
+ *
+ * Config functions run after the init functions, and are called without
+ * a latency section as well. The session pools grow on demand and the
+ * hash and stats memory is only mapped, so unused capacity does not add
+ * to the resident memory.
+ */
+static clib_error_t * latency_config (vlib_main_t * vm,
+                                      unformat_input_t * input)
+{
+  latency_main_t * pm = &latency_main;
+  latency_per_thread_t * ptd;
+  u32 timer_tick_ms;
+  f64 now;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (input, "max-sessions %u", &pm->max_sessions))
+      ;
+    else if (unformat (input, "hash-buckets %u", &pm->hash_buckets))
+      ;
+    else if (unformat (input, "hash-memory %U", unformat_memory_size,
+                       &pm->hash_memory))
+      ;
+    else if (unformat (input, "timer-tick %u", &timer_tick_ms))
+      pm->timer_tick = timer_tick_ms * 1e-3;
+    else if (unformat (input, "output-ring %u", &pm->ring_size))
+      ;
+    else if (unformat (input, "log-segment-size %U", unformat_memory_size,
+                       &pm->log_segment_size))
+      ;
+    else
+      return clib_error_return (0, "unknown input '%U'",
+                                format_unformat_error, input);
+  }
+
+  if (pm->max_sessions == 0 || pm->max_sessions > (1U << 31)) {
+    return clib_error_return (0, "max-sessions must be in 1..2^31");
+  }
+  /* is_pow2 (0) holds */
+  if (pm->hash_buckets == 0 || pm->hash_buckets > LATENCY_MAX_HASH_BUCKETS
+      || !is_pow2 (pm->hash_buckets)) {
+    return clib_error_return (0, "hash-buckets must be a power of 2 in "
+                              "1..%u", LATENCY_MAX_HASH_BUCKETS);
+  }
+  if (pm->timer_tick <= 0) {
+    return clib_error_return (0, "timer-tick must be at least 1 ms");
+  }
+  if (pm->ring_size == 0 || !is_pow2 (pm->ring_size)) {
+    return clib_error_return (0, "output-ring must be a power of 2");
+  }
+  if (pm->log_segment_size < sizeof (latency_log_header_t)
+                             + sizeof (latency_log_record_t)) {
+    return clib_error_return (0, "log-segment-size is too small");
+  }
+
+  /* The number of wheel slots is fixed by the timer template, the idle
+   * timeout has to fit into one revolution */
+  pm->session_timeout = LATENCY_SESSION_TIMEOUT / pm->timer_tick;
+  if (pm->session_timeout == 0
+      || pm->session_timeout >= LATENCY_TIMER_SLOTS) {
+    return clib_error_return (0, "timer-tick must be in %u..%u ms",
+        (u32) (LATENCY_SESSION_TIMEOUT * 1e3 / (LATENCY_TIMER_SLOTS - 1)) + 1,
+        (u32) (LATENCY_SESSION_TIMEOUT * 1e3));
+  }
+
+  now = vlib_time_now (vm);
+  vec_foreach (ptd, pm->per_thread) {
+    /* Init bihash, the name is kept by the bihash */
+    u8 * table_name = format (0, "latency-%u%c", ptd->thread_index, 0);
+    BV (clib_bihash_init) (&ptd->latency_table, (char *) table_name,
+                           pm->hash_buckets, pm->hash_memory);
+    u8 * table6_name = format (0, "latency6-%u%c", ptd->thread_index, 0);
+    clib_bihash_init_48_8 (&ptd->latency_table6, (char *) table6_name,
+                           pm->hash_buckets, pm->hash_memory);
+
+    /* The session pool grows on demand, see latency_reserve_sessions() */
+    ptd->session_pool = 0;
+
+    tw_timer_wheel_init_2t_1w_2048sl (&ptd->tw,
+            timer_expired_callback, pm->timer_tick, ~0);
+    ptd->tw.last_run_time = now;
+  }
+
+  /* Per flow RTT gauges for external collectors, one slot per session */
+  latency_stats_init (vm);
+
+  /* Output rings and files */
+  return latency_output_init (vm);
+}
+
+VLIB_CONFIG_FUNCTION (latency_config, "latency");
+
 /**
  * @brief Hook the LATENCY plugin into the VPP graph hierarchy.
  */
@@ -1297,3 +1477,30 @@ VNET_FEATURE_INIT (latency, static) =
   .node_name = "latency",
   .runs_before = VNET_FEATURES ("ip4-lookup"),
 };
+
+/**
+ * @brief Same as above, used instead with several workers.
+ */
+VNET_FEATURE_INIT (latency_handoff, static) =
+{
+  .arc_name = "ip4-unicast",
+  .node_name = "latency-handoff",
+  .runs_before = VNET_FEATURES ("ip4-lookup"),
+};
+
+/**
+ * @brief IPv6 flows, observed only (no NAT).
+ */
+VNET_FEATURE_INIT (latency_ip6, static) =
+{
+  .arc_name = "ip6-unicast",
+  .node_name = "latency-ip6",
+  .runs_before = VNET_FEATURES ("ip6-lookup"),
+};
+
+VNET_FEATURE_INIT (latency_ip6_handoff, static) =
+{
+  .arc_name = "ip6-unicast",
+  .node_name = "latency-ip6-handoff",
+  .runs_before = VNET_FEATURES ("ip6-lookup"),
+};
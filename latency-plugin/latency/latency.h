@@ -16,24 +16,30 @@
 
 /* High-level overview:
  * 
- * Used data structures:
- * - A bihash_8_8 (bounded-index extensible hash) - 8 byte key and 8 byte value.
+ * Used data structures (one set per thread, see latency_per_thread_t):
+ * - A bihash_24_8 (bounded-index extensible hash) - 24 byte key and 8 byte value.
+ * - A bihash_48_8 for IPv6 flows - 48 byte key and 8 byte value.
  * - A pool is used to save the state for each LATENCY flow (fixed sized struct)
  * - A timer wheel (2t_1w_2048sl = 2 timers per object, 1 wheel, 2048 slots)
  *
- * The key in the hash table consist of (XOR is used to match both directions):
- *   "5 tuple":
- *    - XOR of src and dst IP
- *    - XOR of src and dst port
- *    - protocol
+ * Each thread only touches its own set, so no locking is needed.
  *
- *    - for PLUS packets we also take the CAT value into the hash key
+ * The key in the hash table is the canonical "5 tuple": both (IP, port)
+ * endpoints ordered such that both directions match the same key, and
+ * the protocol. For PLUS packets the CAT is part of the key as well.
+ * Unlike a XOR of both endpoints, this does not merge distinct flows.
+ * IPv6 flows use the same key layout with 16 byte addresses. They are not
+ * NATed, so they only have a single key.
  *
  * The value corresponding to a key (in the hash table) is the pool index
- * for the state of the matching LATENCY flow.
+ * for the state of the matching LATENCY flow, plus a bit which tells the
+ * direction of the packets matching it (LATENCY_KV_CLIENT_LO).
  *
  * Besides the actual "state" of the flow we also save e.g. counters, RTT
  * estimates, ...
+ *
+ * The latest RTT estimates of each flow are also published in shared
+ * memory for external collectors, see latency_stats.h and stats.c.
  */
 
 #ifndef __included_latency_h__
@@ -66,18 +72,36 @@
 #include <vnet/ethernet/ethernet.h>
 
 #include <vppinfra/hash.h>
+#include <vppinfra/bitmap.h>
 #include <vppinfra/error.h>
 #include <vppinfra/elog.h>
 
-/* We use the bihash_8_8 hash function*/
-/* 8 byte key and 8 byte value */
-#include <vppinfra/bihash_8_8.h>
+/* IPv6 flows: 48 byte key and 8 byte value
+ * Only used by its explicit _48_8 names, BV/BVT refer to the
+ * bihash_24_8 included below */
+#include <vppinfra/bihash_48_8.h>
+
+/* We use the bihash_24_8 hash function*/
+/* 24 byte key and 8 byte value */
+#include <vppinfra/bihash_24_8.h>
 
 #include <vppinfra/pool.h>
 
 /* Timer wheel (2 timers, 1 wheel, 2048 slots) */
 #include <vppinfra/tw_timer_2t_1w_2048sl.h>
 
+/* Shared memory layout of the per flow RTT gauges */
+#include <latency/latency_stats.h>
+
+/* Record format of the binary RTT log */
+#include <latency/latency_log.h>
+
+/* PLUS header, parsed into latency_packet_t */
+#include <latency/plus_packet.h>
+
+/* Spin bit estimators, see spin.c */
+#include <latency/spin.h>
+
 /* Defines all the LATENCY states */
 #define foreach_latency_state \
 _(ACTIVE, "default state for TCP and QUIC") \
@@ -112,8 +136,6 @@ typedef enum {
 #define RTT_PRECISION 4
 #define STAT_PRECISION 8
 
-#define SPIN_NOT_KNOWN 255
-
 #define TWO_BIT_SPIN 0xc0
 #define ONE_BIT_SPIN 0x40
 #define VALID_BIT 0x20
@@ -143,72 +165,92 @@ typedef enum {
 #define MAX_PSN 4294967296
 #define MAX_SKIP 100
 
-/* To save current time in hashes */
+/* Outstanding TCP timestamps of one direction, see ts_all_estimate
+ * Fixed size, open addressed: a TSval is stored in one of
+ * LATENCY_TS_WAYS consecutive entries starting at its hash. If all of them
+ * are taken, the new TSval is dropped, unless the oldest entry waited
+ * longer than LATENCY_TS_MAX_AGE for its echo (most TSvals are never
+ * echoed, e.g. with delayed ACKs). With a TSval clock of 1 ms, all TSvals
+ * fit up to an RTT of about LATENCY_TS_ENTRIES ms, above it a subset. */
+#define LATENCY_TS_ENTRIES 64
+#define LATENCY_TS_WAYS 8
+#define LATENCY_TS_MAX_AGE 1000000 /* us */
 typedef struct {
-  f64 time;
-} time_test_t;
+  u32 ts[LATENCY_TS_ENTRIES];
+  u64 time[LATENCY_TS_ENTRIES];
+  /* Bitmap of the used entries */
+  u64 valid;
+} latency_ts_table_t;
 
-/* Structs for the different spin observers */
-typedef struct {
-  u8 spin_client;
-  u8 spin_server;
-  f64 time_last_spin_client;
-  f64 time_last_spin_server;
-  f64 rtt_client;
-  f64 rtt_server;
-  bool new_client;
-  bool new_server;
-} basic_spin_observer_t;
+/* Observer times are microseconds of VPP time (u64) and RTTs are
+ * microseconds (u32). They are only converted to seconds for the output,
+ * the per packet path does integer arithmetic only. */
+
+/**
+ * @brief current time in microseconds, read once per frame
+ */
+always_inline u64 latency_time_now_us(vlib_main_t * vm) {
+  return vlib_time_now (vm) * 1e6;
+}
 
+/**
+ * @brief microseconds to seconds, for the output only
+ */
+always_inline f64 latency_us_to_s(u64 us) {
+  return us * 1e-6;
+}
+
+/* Direction of a packet, index of the per direction observer state
+ * Resolved once per packet from the flow key, see LATENCY_KV_CLIENT_LO */
+#define LATENCY_DIR_CLIENT 0
+#define LATENCY_DIR_SERVER 1
+
+/* RTT histogram of the flow summaries, two buckets per octave of
+ * microseconds: bucket 2k counts [2^k, 1.5 * 2^k), 2k + 1 counts
+ * [1.5 * 2^k, 2^(k + 1)). The last bucket also counts everything above. */
+#define LATENCY_SUMMARY_BUCKETS 48
+
+/* Running aggregates of one estimator and direction */
 typedef struct {
-  u8 spin_client;
-  u8 spin_server;
-  f64 time_last_spin_client;
-  f64 time_last_spin_server;
-  f64 rtt_client;
-  f64 rtt_server;
-  u32 pn_client;
-  u32 pn_server;
-  bool new_client;
-  bool new_server;
-} pn_spin_observer_t;
-
-#define STATUS_INVALID      0b00
-#define STATUS_HANDSHAKE_1  0b01
-#define STATUS_HANDSHAKE_2  0b10
-#define STATUS_VALID        0b11
+  u32 n_samples;
+  /* Microseconds */
+  u32 min;
+  u32 max;
+  u64 sum;
+  u32 hist[LATENCY_SUMMARY_BUCKETS];
+} latency_rtt_summary_t;
+
+/* Aggregates of a flow in summary output mode, queued and freed when the
+ * session is cleaned up */
 typedef struct {
-  u8 spin_client;
-  u8 spin_server;
-  f64 time_last_spin_client;
-  f64 time_last_spin_server;
-  f64 rtt_client;
-  f64 rtt_server;
-  bool new_client;
-  bool new_server;
-} status_spin_observer_t;
-
-#define DYNA_HEUR_THRESHOLD 0.1
-#define DYNA_HEUR_HISTORY_SIZE 10
-#define DYNA_HEUR_MAX_REJECT 5
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* First and last RTT sample */
+  u64 time_first;
+  u64 time_last;
+  /* Indexed by the direction of the output record and the estimator */
+  latency_rtt_summary_t rtt[2][LATENCY_STATS_N_ESTIMATORS];
+} latency_summary_t;
+
+/* Output state of an observer, see latency_record_sample() */
 typedef struct {
-  u8 spin_client;
-  u8 spin_server;
-  f64 time_last_spin_client;
-  f64 time_last_spin_server;
-  f64 rtt_client[DYNA_HEUR_HISTORY_SIZE];
-  f64 rtt_server[DYNA_HEUR_HISTORY_SIZE];
-  u8 index_client;
-  u8 index_server;
-  u8 rejected_client;
-  u8 rejected_server;
-  bool new_client;
-  bool new_server;
-} dyna_heur_spin_observer_t;
+  /* Last queued sample, indexed by the direction of the output record */
+  u32 rtt[2][LATENCY_STATS_N_ESTIMATORS];
+  /* 0 until the first sample of the direction */
+  u64 time[2];
+  /* Index of the aggregates in the summary_pool of the thread, ~0 until
+   * the first sample in summary output mode */
+  u32 summary_index;
+} latency_emit_t;
 
 /* main QUIC observer struct */
 typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
   u64 id;
+  /* See latency_flow_id() */
+  u64 flow_id;
+  latency_emit_t emit;
 
   /* Data structures for the various spin bit observers */
   basic_spin_observer_t basic_spin_observer;
@@ -219,88 +261,389 @@ typedef struct {
 
 /* structs for the different TCP TS observers */
 typedef struct { 
-  f64 time_init_client;
-  f64 time_init_server;
-  f64 rtt_client;
-  f64 rtt_server;
-  u32 ts_init_client;
-  u32 ts_init_server;
-  u32 ts_ack_client;
-  u32 ts_ack_server;
-  bool new_client;
-  bool new_server;
+  u64 time_init[2];
+  u32 rtt[2];
+  u32 ts_init[2];
+  u32 ts_ack[2];
+  bool new_rtt[2];
 } timestamp_observer_single_RTT_t;
 
 typedef struct {
-  uword *hash_init_client;
-  uword *hash_init_server;
-  uword *hash_ack_client;
-  uword *hash_ack_server;
-  f64 rtt_client;
-  f64 rtt_server;
-  bool new_client;
-  bool new_server;
+  /* TSval -> time the TSval was first seen */
+  latency_ts_table_t init[2];
+  /* TSval of the echoing packet -> time of the echoed TSval */
+  latency_ts_table_t ack[2];
+  /* Newest TSval added to init, a TSval is only added when first seen */
+  u32 tsval_last[2];
+  bool tsval_seen[2];
+  u32 rtt[2];
+  bool new_rtt[2];
 } timestamp_observer_all_RTT_t;
 
+/* TCP timestamp observers, only allocated once a flow carries TSvals */
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  timestamp_observer_single_RTT_t ts_one_RTT_observer;
+  timestamp_observer_all_RTT_t ts_all_RTT_observer;
+} tcp_ts_observer_t;
+
 /* main TCP observer struct */
 typedef struct {
-  /* Data structures for the latency and timestamp observer */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* See latency_flow_id() */
+  u64 flow_id;
+  latency_emit_t emit;
+
+  /* Data structures for the latency observer */
   status_spin_observer_t status_spin_observer;
   status_spin_observer_t vec_ne_zero;
-  timestamp_observer_single_RTT_t ts_one_RTT_observer;
-  timestamp_observer_all_RTT_t ts_all_RTT_observer;
+
+  /* Index of the timestamp observers in the tcp_ts_pool of the thread,
+   * ~0 until the first TSval */
+  u32 ts_index;
 } tcp_observer_t;
 
 /* struct for PLUS PSE/PSN observer */
 typedef struct {
-  u32 psn_src;
-  f64 time_src;
-  f64 rtt_src;
-  u32 psn_dst;
-  f64 time_dst;
-  f64 rtt_dst;
-  bool new_server;
-  bool new_client;
+  u32 psn[2];
+  u64 time[2];
+  u32 rtt[2];
+  bool new_rtt[2];
 } plus_single_observer_t;
 
 /* main PLUS observer struct */
 typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
   u8 state;
   /* PSN which moved state to ASSOCIATING */
   u32 psn_associating;
   /* PSN which moved state to STOPWAIT */
   u32 psn_stopwait;
   u64 cat;
+  /* See latency_flow_id() */
+  u64 flow_id;
+  latency_emit_t emit;
 
   plus_single_observer_t plus_single_observer;
 } plus_observer_t;
 
-/* State for each observed LATENCY session */
+/* Hash key struct */
+typedef CLIB_PACKED (struct {
+  union {
+    struct {
+      /* Endpoint with the lower (IP, port) first */
+      u32 ip_lo;
+      u32 ip_hi;
+      u16 port_lo;
+      u16 port_hi;
+      u8 protocol;
+      u8 pad[3];
+      /* PLUS only, 0 otherwise */
+      u64 cat;
+    };
+    u64 as_u64[3];
+  };
+}) latency_key_t;
+
+/* Hash key struct for IPv6 flows, same layout as latency_key_t */
+typedef CLIB_PACKED (struct {
+  union {
+    struct {
+      /* Endpoint with the lower (IP, port) first */
+      ip6_address_t ip_lo;
+      ip6_address_t ip_hi;
+      u16 port_lo;
+      u16 port_hi;
+      u8 protocol;
+      u8 pad[3];
+      /* PLUS only, 0 otherwise */
+      u64 cat;
+    };
+    u64 as_u64[6];
+  };
+}) latency_key6_t;
+
+/* State for each observed LATENCY session
+ * Hot part: everything the per packet path (estimation, NAT, timer)
+ * needs, one cache line. The flow keys are only needed to create and
+ * clean up a session, they are kept in latency_session_cold_t. */
 typedef struct {
-  latency_state_t state;
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
 
-  sup_protocols_t p_type;
+  /* latency_state_t */
+  u8 state;
+
+  /* sup_protocols_t */
+  u8 p_type;
+
+  u8 is_ip6;
 
   /* Pool index (saved in hash table) */
   u32 index;
   u32 timer;
-  u64 key;
-  u64 key_reverse;
-  
+
   u32 init_src_ip;
   u16 init_src_port;
   u32 new_dst_ip;
+
+  /* dst IP of the first packet and MB IP used for the rewrite */
+  u32 init_dst_ip;
+  u32 mb_ip;
+
+  /* Folded checksum deltas of the NAT rewrite, precomputed at session
+   * creation for the client->MB (fwd) and server->MB (rev) leg */
+  u16 csum_delta_fwd;
+  u16 csum_delta_rev;
   
   /* Number of observed packets */
   u32 pkt_count;
 
-  /* QUIC and TCP observers
-   * only required values are allocated */
-  quic_observer_t * quic;
-  tcp_observer_t * tcp;
-  plus_observer_t * plus;
+  /* Index of the QUIC, TCP or PLUS observer (depending on p_type) in
+   * the observer pools of the thread. ~0 until the flow carries a signal
+   * (spin/VEC bits, TCP timestamps, PLUS header), flows without one only
+   * keep this record */
+  u32 observer_index;
 } latency_session_t;
 
+STATIC_ASSERT (sizeof (latency_session_t) == CLIB_CACHE_LINE_BYTES,
+               "latency_session_t must fit into one cache line");
+
+/* Cold part of a session, same index as the session */
+typedef struct {
+  union {
+    /* IPv4: keys of both NAT legs */
+    struct {
+      latency_key_t key;
+      latency_key_t key_reverse;
+    };
+    /* IPv6: no NAT, a single key */
+    latency_key6_t key6;
+  };
+} latency_session_cold_t;
+
+/* Flow counters, per thread vlib simple counters (latency_main_t.counters) */
+#define foreach_latency_counter \
+_(TOTAL_FLOWS, "total flows") \
+_(ACTIVE_FLOWS, "active flows") \
+_(ACTIVE_TCP, "active TCP flows") \
+_(ACTIVE_QUIC, "active QUIC flows") \
+_(ACTIVE_PLUS, "active PLUS flows") \
+_(OUTPUT_DROPS, "output records dropped") \
+_(DEADBAND_SKIPPED, "samples within deadband")
+
+typedef enum {
+#define _(sym,str) LATENCY_COUNTER_##sym,
+  foreach_latency_counter
+#undef _
+  LATENCY_N_COUNTER,
+} latency_counter_t;
+
+/* Output files, the CSV lines of each protocol go to their own file */
+#define foreach_latency_output \
+_(QUIC, "/tmp/latency_quic_printf.out") \
+_(TCP, "/tmp/latency_tcp_printf.out") \
+_(PLUS, "/tmp/latency_plus_printf.out") \
+_(SUMMARY, "/tmp/latency_summary_printf.out")
+
+typedef enum {
+#define _(sym,path) LATENCY_OUTPUT_##sym,
+  foreach_latency_output
+#undef _
+  LATENCY_N_OUTPUT,
+} latency_output_t;
+
+/* What the writer process does with the output records */
+typedef enum {
+  /* CSV files, foreach_latency_output */
+  LATENCY_OUTPUT_MODE_CSV,
+  /* Binary RTT log, see latency_log.h */
+  LATENCY_OUTPUT_MODE_BINARY,
+  /* No samples, one summary per flow (LATENCY_OUTPUT_SUMMARY) */
+  LATENCY_OUTPUT_MODE_SUMMARY,
+} latency_output_mode_t;
+
+/* One line of output, written by the packet path without any formatting.
+ * The writer process (output.c) turns it into the CSV line or binary log
+ * records, depending on the output mode. */
+typedef struct {
+  /* Flow of the observer, see latency_flow_id() */
+  u64 flow_id;
+  /* Packet time (microseconds), first RTT sample of a summary */
+  u64 time;
+  union {
+    /* Sample */
+    struct {
+      /* PLUS CAT */
+      u64 cat;
+      /* RTT of each estimator, in the column order of the CSV output */
+      u32 rtt[LATENCY_STATS_N_ESTIMATORS];
+      /* QUIC packet number, TCP sequence number or PLUS packet count */
+      u32 seq;
+      /* PLUS PSN and PSE */
+      u32 psn;
+      u32 pse;
+    };
+    /* Summary of one estimator of a flow (is_summary) */
+    struct {
+      /* First to last RTT sample (microseconds) */
+      u64 duration;
+      u32 n_samples;
+      /* Microseconds */
+      u32 rtt_min;
+      u32 rtt_mean;
+      u32 rtt_max;
+      u32 rtt_p50;
+      u32 rtt_p99;
+      /* Column of the estimator in the CSV output of the protocol */
+      u8 estimator;
+    };
+  };
+  /* latency_output_t of the protocol */
+  u8 output;
+  /* CSV header line instead of a sample */
+  u8 is_header;
+  /* Flow summary instead of a sample, written to LATENCY_OUTPUT_SUMMARY */
+  u8 is_summary;
+  /* LATENCY_DIR_* of the host column */
+  u8 dir;
+  /* Bitmap of the estimators with a new sample */
+  u8 new_rtt;
+} latency_record_t;
+
+/* Single producer (the thread owning it), single consumer (the writer
+ * process) ring of output records. head and tail are free running and
+ * live in their own cache lines. */
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  /* Next record to write, only written by the producer */
+  volatile u32 head;
+
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  /* Next record to read, only written by the consumer */
+  volatile u32 tail;
+
+  /* Power of 2 */
+  u32 size;
+  latency_record_t * records;
+} latency_ring_t;
+
+/* Parsed headers of one packet, filled in before the session lookup */
+typedef struct {
+  /* Only one of them is set */
+  ip4_header_t * ip0;
+  ip6_header_t * ip60;
+  udp_header_t * udp0;
+  tcp_header_t * tcp0;
+  plus_header_t * plus0;
+
+  /* Hash key (valid if p_type != P_UNKNOWN) */
+  union {
+    latency_key_t kv;
+    latency_key6_t kv6;
+  };
+
+  u16 src_port;
+  u16 dst_port;
+
+  /* The src endpoint is the lo endpoint of the key */
+  u8 src_lo;
+  /* LATENCY_DIR_*, known once the session is looked up */
+  u8 dir;
+
+  u64 connection_id;
+  u32 packet_number;
+  u32 tsval;
+  u32 tsecr;
+
+  /* Keeps track of all the buffer movement */
+  u8 total_advance;
+  u8 measurement;
+  bool is_udp;
+  bool make_measurement;
+
+  /* P_UNKNOWN if the packet is not tracked */
+  sup_protocols_t p_type;
+
+  /* Reason if not tracked, LATENCY_ERROR_NONE otherwise */
+  u8 error;
+} latency_packet_t;
+
+/* Next nodes of the classifier, the protocol nodes of its address family */
+#define foreach_latency_classify_next \
+_(LOOKUP, "lookup") \
+_(DROP, "drop") \
+_(QUIC, "quic") \
+_(TCP, "tcp") \
+_(PLUS, "plus")
+
+typedef enum {
+#define _(sym,str) LATENCY_CLASSIFY_NEXT_##sym,
+  foreach_latency_classify_next
+#undef _
+  LATENCY_CLASSIFY_N_NEXT,
+} latency_classify_next_t;
+
+/* Flow state of one thread, only ever written by that thread */
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* Hash table */
+  BVT (clib_bihash) latency_table;
+
+  /* Hash table for IPv6 flows, sessions share the pool below */
+  clib_bihash_48_8_t latency_table6;
+
+  /* Session pool, cache line aligned elements */
+  latency_session_t * session_pool;
+
+  /* Cold session parts, indexed like session_pool */
+  latency_session_cold_t * session_cold;
+
+  /* Observer pools, cache line aligned elements */
+  quic_observer_t * quic_pool;
+  tcp_observer_t * tcp_pool;
+  tcp_ts_observer_t * tcp_ts_pool;
+  plus_observer_t * plus_pool;
+
+  /* Flow summaries, only used in summary output mode */
+  latency_summary_t * summary_pool;
+
+  /* Thread owning this state, for the per thread counters */
+  u32 thread_index;
+
+  /* Sessions cleaned by the current expire_timers run, only counted by
+   * the timer callback */
+  u32 n_expired;
+
+  /* Flows of this thread which got an observer so far */
+  u64 n_flow_ids;
+
+  /* Timer wheel*/
+  tw_timer_wheel_2t_1w_2048sl_t tw;
+
+  /* Output records of this thread, drained by the writer process */
+  latency_ring_t * ring;
+
+  /* Block of RTT gauge slots in shared memory, NULL if not exported */
+  latency_stats_slot_t * stats_slots;
+
+  /* Per frame scratch of the nodes, kept off the worker stack (64 KB)
+   * Protocol nodes, see latency_inline() */
+  CLIB_CACHE_LINE_ALIGN_MARK (scratch);
+  latency_packet_t pkts[VLIB_FRAME_SIZE];
+  latency_key_t * keys[VLIB_FRAME_SIZE];
+  latency_key6_t * keys6[VLIB_FRAME_SIZE];
+  latency_session_t * sessions[VLIB_FRAME_SIZE];
+  u8 client_lo[VLIB_FRAME_SIZE];
+
+  /* Classifier, see latency_classify_inline() */
+  u32 classify_next[VLIB_FRAME_SIZE];
+  u32 classify_lists[LATENCY_CLASSIFY_N_NEXT][VLIB_FRAME_SIZE];
+} latency_per_thread_t;
+
 /* Main latency struct */
 typedef struct {
   /* API message ID base */
@@ -311,120 +654,660 @@ typedef struct {
 
   /* convenience */
   vnet_main_t * vnet_main;
-    
-  /* Hash table */
-  BVT (clib_bihash) latency_table;
 
-  /* Session pool */
-  latency_session_t * session_pool;
+  /* Per thread flow state, indexed by thread index */
+  latency_per_thread_t * per_thread;
+
+  /* Flow counters, indexed by latency_counter_t */
+  vlib_simple_counter_main_t counters;
 
-  /* Contains all ports that indicated QUIC traffic */
-  uword *hash_quic_ports;
+  /* Worker handoff, see handoff.c */
+  u32 first_worker_index;
+  u32 num_workers;
+  u32 fq_index;
+  u32 fq_index6;
+  u32 error_drop_node_index;
+
+  /* Bitmaps of the QUIC ports and the NAT (dst) ports, indexed by the
+   * port in network byte order. Sized for all ports up front, such that
+   * setting a port never reallocates them under the workers */
+  uword * quic_port_bitmap;
+  uword * nat_port_bitmap;
 
   /* To translate dst port to required dst IP */
   uword *hash_server_ports_to_ips;
-          
-  /* Counter values*/
-  u32 total_flows;
-  u32 active_flows;
-  u32 active_tcp;
-  u32 active_quic;
 
-  /* Timer wheel*/
-  tw_timer_wheel_2t_1w_2048sl_t tw;
-} latency_main_t;
+  /* Passive (observe only) mode: no NAT, packets are dropped after the
+   * measurement, e.g. for traffic from a mirror port */
+  u8 passive;
 
-/* Hash key struct */
-typedef CLIB_PACKED (struct {
-  union {
-    struct {
-      /* IP and port XOR */
-      u32 s_x_d_ip;
-      u16 s_x_d_port;
-      u16 protocol;
-    };
-    u64 as_u64;
-  };
-}) latency_key_t;
+  /* Housekeeping (timer expiry) interval in seconds */
+  f64 housekeeping_interval;
+
+  /* Capacity, set by the latency startup config section (latency_config) */
+  u32 max_sessions;
+  u32 hash_buckets;
+  uword hash_memory;
+  f64 timer_tick;
+  /* Session idle timeout in timer ticks */
+  u32 session_timeout;
+
+  /* Output files and the lines formatted by the writer process */
+  FILE * output[LATENCY_N_OUTPUT];
+  u8 * output_buf[LATENCY_N_OUTPUT];
+  /* Output records per thread (output-ring) */
+  u32 ring_size;
+  /* latency_output_mode_t */
+  u8 output_mode;
+
+  /* Binary RTT log (see latency_log.h), the mapped segment and its size
+   * (log-segment-size). NULL if no segment is open */
+  latency_log_header_t * log;
+  uword log_segment_size;
+  /* Number of the next segment file */
+  u32 log_segment;
+  /* Segment could not be created, log records are dropped until the
+   * output mode is set again */
+  u8 log_failed;
 
-latency_main_t latency_main;
+  /* Deadband emission (latency deadband): if on, a sample is only queued
+   * if an estimator moved by more than deadband_abs (microseconds) or
+   * deadband_rel (percent) since the last queued sample of the flow and
+   * direction, or deadband_interval (microseconds, 0: none) passed */
+  u8 deadband;
+  u32 deadband_abs;
+  u32 deadband_rel;
+  u64 deadband_interval;
+
+  /* Shared memory RTT gauges (see stats.c), NULL if not available */
+  latency_stats_header_t * stats;
+  uword stats_size;
+  u32 stats_slots_per_thread;
+} latency_main_t;
+
+extern latency_main_t latency_main;
 
 extern vlib_node_registration_t latency_node;
+extern vlib_node_registration_t latency_expire_node;
+extern vlib_node_registration_t latency_housekeeping_node;
+extern vlib_node_registration_t latency_handoff_node;
+extern vlib_node_registration_t latency_ip6_node;
+extern vlib_node_registration_t latency_ip6_handoff_node;
+
+/* Default housekeeping interval (one timer wheel tick) */
+#define LATENCY_HOUSEKEEPING_INTERVAL 100e-3
+
+/* Default capacity per thread, see latency_config */
+#define LATENCY_DEFAULT_MAX_SESSIONS (1 << 16)
+#define LATENCY_DEFAULT_HASH_BUCKETS (1 << 14)
+#define LATENCY_MAX_HASH_BUCKETS (1 << 24)
+#define LATENCY_DEFAULT_HASH_MEMORY (64 << 20)
+#define LATENCY_DEFAULT_TIMER_TICK 100e-3
+#define LATENCY_DEFAULT_RING_SIZE (1 << 14)
+#define LATENCY_DEFAULT_LOG_SEGMENT_SIZE (64 << 20)
+
+/* Interval (seconds) of the output writer process */
+#define LATENCY_OUTPUT_INTERVAL 10e-3
+
+/* Timer wheel slots, fixed by the tw_timer_2t_1w_2048sl template */
+#define LATENCY_TIMER_SLOTS 2048
+
+/* Idle time (seconds) after which a session is cleaned up */
+#define LATENCY_SESSION_TIMEOUT 30.0
+
+/* Events for the housekeeping process */
+#define LATENCY_EVENT_INTERVAL 1
+
+/* The bihash value of a flow key is the session index, with this bit set
+ * if the client is the lo endpoint of the key (see make_key). XORed with
+ * the endpoint order of a packet it gives the packet direction. */
+#define LATENCY_KV_CLIENT_LO (1ULL << 32)
+
+always_inline u64 latency_kv_value(u32 index, u8 client_lo) {
+  return index | (client_lo ? LATENCY_KV_CLIENT_LO : 0);
+}
 
 u64 get_state(latency_key_t * kv_in);
-void update_state(latency_key_t * kv_in, uword new_state);
-void make_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
+int update_state(latency_per_thread_t * ptd, latency_key_t * kv_in,
+                uword new_state);
+u8 make_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
                 u16 src_p, u16 dst_p, u8 protocol);
-void make_plus_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
+u8 make_plus_key(latency_key_t * kv, u32 src_ip, u32 dst_ip,
                 u16 src_p, u16 dst_p, u8 protocol, u64 cat);
-latency_session_t * get_session_from_key(latency_key_t * kv_in);
-u32 create_session(sup_protocols_t p_type);
+latency_session_t * get_session_from_key(latency_per_thread_t * ptd,
+                latency_key_t * kv_in, u8 * client_lo);
+int update_state6(latency_per_thread_t * ptd, latency_key6_t * kv_in,
+                uword new_state);
+u8 make_key6(latency_key6_t * kv, ip6_address_t * src_ip,
+                ip6_address_t * dst_ip, u16 src_p, u16 dst_p, u8 protocol);
+u8 make_plus_key6(latency_key6_t * kv, ip6_address_t * src_ip,
+                ip6_address_t * dst_ip, u16 src_p, u16 dst_p, u8 protocol,
+                u64 cat);
+latency_session_t * get_session_from_key6(latency_per_thread_t * ptd,
+                latency_key6_t * kv_in, u8 * client_lo);
+u32 create_session(latency_per_thread_t * ptd, sup_protocols_t p_type);
+void abort_session(latency_per_thread_t * ptd, latency_session_t * session,
+        int key_added);
+quic_observer_t * create_quic_observer(latency_per_thread_t * ptd,
+        latency_session_t * session);
+tcp_observer_t * create_tcp_observer(latency_per_thread_t * ptd,
+        latency_session_t * session);
+tcp_ts_observer_t * create_tcp_ts_observer(latency_per_thread_t * ptd,
+        tcp_observer_t * tcp);
+plus_observer_t * create_plus_observer(latency_per_thread_t * ptd,
+        latency_session_t * session);
 
 void update_quic_rtt_estimate(vlib_main_t * vm, quic_observer_t * session,
-        f64 now, u16 src_port, u16 init_src_port, u8 measurement,
-        u32 packet_number, u32 pkt_count);
-bool basic_latency_estimate(vlib_main_t * vm, basic_spin_observer_t *observer,
-        f64 now, u16 src_port, u16 init_src_port, bool spin);
-bool pn_latency_estimate(vlib_main_t * vm, pn_spin_observer_t *observer,
-        f64 now, u16 src_port, u16 init_src_port, bool spin, u32 packet_number);
-bool status_estimate(vlib_main_t * vm, status_spin_observer_t *observer,
-        f64 now, u16 src_port, u16 init_src_port, bool spin, u8 status);
-bool vec_ne_zero_estimate(vlib_main_t * vm, status_spin_observer_t *observer,
-      f64 now, u16 src_port, u16 init_src_port, bool spin, u8 status);
-bool heuristic_estimate(vlib_main_t * vm, dyna_heur_spin_observer_t *observer,
-        f64 now, u16 src_port, u16 init_src_port, bool spin);
+        u64 now, u8 dir, u8 measurement, u32 packet_number, bool first);
 void update_tcp_rtt_estimate(vlib_main_t * vm, tcp_observer_t * session,
-        f64 now, u16 src_port, u16 init_src_port, u8 measurement, u32 tsval,
-        u32 tsecr, u32 pkt_count, u32 seq_num);
+        tcp_ts_observer_t * ts, u64 now, u8 dir, u8 measurement,
+        u32 tsval, u32 tsecr, bool first, u32 seq_num);
 bool ts_single_estimate(vlib_main_t * vm,
         timestamp_observer_single_RTT_t * observer,
-        f64 now, u16 src_port, u16 init_src_port, u32 tsval, u32 tsecr);
+        u64 now, u8 dir, u32 tsval, u32 tsecr);
 bool ts_all_estimate(vlib_main_t * vm, timestamp_observer_all_RTT_t * observer,
-        f64 now, u16 src_port, u16 init_src_port, u32 tsval, u32 tsecr);
+        u64 now, u8 dir, u32 tsval, u32 tsecr);
 int tcp_options_parse_mod (tcp_header_t * th, u32 * tsval, u32 * tsecr);
 void update_plus_rtt_estimate(vlib_main_t * vm, plus_observer_t * session,
-        f64 now, u16 src_port, u16 init_src_port, u32 psn,
-        u32 pse, u64 cat, u32 pkt_count);
+        u64 now, u8 dir, u32 psn, u32 pse, u64 cat, u32 pkt_count);
 bool psn_single_estimate(vlib_main_t * vm, plus_single_observer_t * session,
-        u16 src_port, u16 init_src_port, u32 psn, u32 pse, f64 now);
-bool ip_nat_translation(ip4_header_t *ip0, u32 init_src_ip, u32 new_dst_ip);
+        u8 dir, u32 psn, u32 pse, u64 now);
+
+int clean_session(latency_per_thread_t * ptd, u32 index);
+clib_error_t * latency_output_init (vlib_main_t * vm);
+
+void latency_stats_init (vlib_main_t * vm);
+void latency_stats_session_open (latency_per_thread_t * ptd,
+                latency_session_t * session, u64 now);
+void latency_stats_session_close (latency_per_thread_t * ptd,
+                latency_session_t * session);
+void latency_stats_set_time (u64 now);
+
+/**
+ * @brief get the flow state of a thread
+ */
+always_inline latency_per_thread_t * get_per_thread(u32 thread_index) {
+  return vec_elt_at_index (latency_main.per_thread, thread_index);
+}
+
+/**
+ * @brief add n (may be negative) to a flow counter of the thread
+ */
+always_inline void latency_count(latency_per_thread_t * ptd,
+                latency_counter_t counter, i32 n) {
+  vlib_increment_simple_counter (&latency_main.counters, ptd->thread_index,
+                                 counter, n);
+}
+
+/**
+ * @brief count a session as opened (n = 1) or closed (n = -1)
+ *
+ * Only sessions with all their keys in the flow table are counted, see
+ * abort_session().
+ */
+always_inline void latency_count_session(latency_per_thread_t * ptd,
+                latency_session_t * session, i32 n) {
+  latency_count(ptd, LATENCY_COUNTER_ACTIVE_FLOWS, n);
+  if (n > 0) {
+    latency_count(ptd, LATENCY_COUNTER_TOTAL_FLOWS, n);
+  }
+  switch (session->p_type) {
+    case P_TCP:
+      latency_count(ptd, LATENCY_COUNTER_ACTIVE_TCP, n);
+      break;
+    case P_QUIC:
+      latency_count(ptd, LATENCY_COUNTER_ACTIVE_QUIC, n);
+      break;
+    case P_PLUS:
+      latency_count(ptd, LATENCY_COUNTER_ACTIVE_PLUS, n);
+      break;
+    default:
+      break;
+  }
+}
+
+/**
+ * @brief new flow id, unique per VPP run
+ *
+ * Assigned when a flow gets its observer, the flows without one never
+ * produce output.
+ */
+always_inline u64 latency_flow_id(latency_per_thread_t * ptd) {
+  return ((u64) ptd->thread_index << 48) | ++ptd->n_flow_ids;
+}
+
+/**
+ * @brief get the next free output record of the calling thread
+ *
+ * Returns NULL (and counts the drop) if the writer fell behind and the
+ * ring is full, the packet path never waits for the output.
+ * The record is published by latency_record_put().
+ */
+always_inline latency_record_t * latency_record_get(latency_per_thread_t * ptd,
+                latency_output_t output) {
+  latency_ring_t * r = ptd->ring;
+  latency_record_t * rec;
+  u32 head = r->head;
 
-void clean_session(u32 index);
-void latency_printf (int flush, char *fmt, ...);
-void tcp_printf (int flush, char *fmt, ...);
-void plus_printf (int flush, char *fmt, ...);
+  if (head - __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE) >= r->size) {
+    latency_count(ptd, LATENCY_COUNTER_OUTPUT_DROPS, 1);
+    return 0;
+  }
+  rec = &r->records[head & (r->size - 1)];
+  rec->output = output;
+  rec->is_header = 0;
+  rec->is_summary = 0;
+  rec->new_rtt = 0;
+  return rec;
+}
+
+/**
+ * @brief publish the record returned by latency_record_get()
+ */
+always_inline void latency_record_put(latency_per_thread_t * ptd) {
+  latency_ring_t * r = ptd->ring;
+  __atomic_store_n (&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief queue the CSV header line of an output
+ */
+always_inline void latency_record_header(latency_per_thread_t * ptd,
+                latency_output_t output) {
+  latency_record_t * rec;
+
+  /* The summary file has a single header, see latency_output_init() */
+  if (latency_main.output_mode == LATENCY_OUTPUT_MODE_SUMMARY) {
+    return;
+  }
+  rec = latency_record_get(ptd, output);
+  if (rec) {
+    rec->is_header = 1;
+    latency_record_put(ptd);
+  }
+}
+
+/**
+ * @brief deadband check of a sample, true if it is to be queued
+ *
+ * Only the estimators with a new sample count. With both thresholds set
+ * the smaller one applies, with none any change is queued.
+ */
+always_inline bool latency_emit_check(latency_emit_t * emit, u8 dir, u64 now,
+                u32 * rtt, u8 new_rtt, u32 n_rtt) {
+  latency_main_t * pm = &latency_main;
+  u32 i, last, delta, limit;
+  u64 rel;
+
+  if (!pm->deadband || !emit->time[dir]) {
+    return true;
+  }
+  if (pm->deadband_interval && now - emit->time[dir] >= pm->deadband_interval) {
+    return true;
+  }
+  for (i = 0; i < n_rtt; i++) {
+    if (!((new_rtt >> i) & 1)) {
+      continue;
+    }
+    last = emit->rtt[dir][i];
+    delta = rtt[i] > last ? rtt[i] - last : last - rtt[i];
+    limit = pm->deadband_abs;
+    if (pm->deadband_rel) {
+      rel = (u64) last * pm->deadband_rel / 100;
+      if (!limit || rel < limit) {
+        limit = rel;
+      }
+    }
+    if (delta > limit) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief histogram bucket of an RTT, see LATENCY_SUMMARY_BUCKETS
+ */
+always_inline u32 latency_summary_bucket(u32 rtt) {
+  u32 k, b;
+
+  if (rtt < 2) {
+    return 0;
+  }
+  k = min_log2 (rtt);
+  b = 2 * k + ((rtt >> (k - 1)) & 1);
+  return b < LATENCY_SUMMARY_BUCKETS ? b : LATENCY_SUMMARY_BUCKETS - 1;
+}
+
+/**
+ * @brief add the new samples of n_rtt estimators to the flow summary
+ *
+ * The summary is allocated with the first sample of the flow.
+ */
+always_inline void latency_summary_add(latency_per_thread_t * ptd,
+                latency_emit_t * emit, u64 now, u8 dir, u32 * rtt,
+                u8 new_rtt, u32 n_rtt) {
+  latency_summary_t * sum;
+  latency_rtt_summary_t * a;
+  u32 i;
+
+  if (emit->summary_index == ~0) {
+    pool_get_aligned (ptd->summary_pool, sum, CLIB_CACHE_LINE_BYTES);
+    memset (sum, 0, sizeof (*sum));
+    sum->time_first = now;
+    emit->summary_index = sum - ptd->summary_pool;
+  } else {
+    sum = pool_elt_at_index (ptd->summary_pool, emit->summary_index);
+  }
+
+  for (i = 0; i < n_rtt; i++) {
+    if (!((new_rtt >> i) & 1)) {
+      continue;
+    }
+    a = &sum->rtt[dir][i];
+    if (!a->n_samples || rtt[i] < a->min) {
+      a->min = rtt[i];
+    }
+    if (rtt[i] > a->max) {
+      a->max = rtt[i];
+    }
+    a->sum += rtt[i];
+    a->n_samples++;
+    a->hist[latency_summary_bucket(rtt[i])]++;
+  }
+  sum->time_last = now;
+}
+
+/**
+ * @brief get an output record for a sample of n_rtt estimators
+ *
+ * Returns NULL if the sample is within the deadband (or the ring is
+ * full) and in summary output mode, where the sample only goes into the
+ * flow summary. Otherwise the common fields are filled in, the caller
+ * adds the protocol specific ones and publishes it with
+ * latency_record_put().
+ */
+always_inline latency_record_t * latency_record_sample(
+                latency_per_thread_t * ptd, latency_output_t output,
+                latency_emit_t * emit, u64 flow_id, u64 now, u8 dir,
+                u32 * rtt, u8 new_rtt, u32 n_rtt) {
+  latency_record_t * rec;
+
+  if (latency_main.output_mode == LATENCY_OUTPUT_MODE_SUMMARY) {
+    latency_summary_add(ptd, emit, now, dir, rtt, new_rtt, n_rtt);
+    return 0;
+  }
+  if (!latency_emit_check(emit, dir, now, rtt, new_rtt, n_rtt)) {
+    latency_count(ptd, LATENCY_COUNTER_DEADBAND_SKIPPED, 1);
+    return 0;
+  }
+  rec = latency_record_get(ptd, output);
+  if (!rec) {
+    return 0;
+  }
+  rec->flow_id = flow_id;
+  rec->time = now;
+  rec->dir = dir;
+  rec->new_rtt = new_rtt;
+  clib_memcpy (rec->rtt, rtt, n_rtt * sizeof (u32));
+
+  clib_memcpy (emit->rtt[dir], rtt, n_rtt * sizeof (u32));
+  emit->time[dir] = now;
+  return rec;
+}
 
 /**
  * @brief get latency session for index
  */
-always_inline latency_session_t * get_latency_session(u32 index) {
-  if (pool_is_free_index (latency_main.session_pool, index))
+always_inline latency_session_t * get_latency_session(latency_per_thread_t * ptd,
+                u32 index) {
+  if (pool_is_free_index (ptd->session_pool, index))
+    return 0;
+  return pool_elt_at_index (ptd->session_pool, index);
+}
+
+/**
+ * @brief get the cold part of a session
+ */
+always_inline latency_session_cold_t *
+get_latency_session_cold(latency_per_thread_t * ptd,
+                latency_session_t * session) {
+  return vec_elt_at_index (ptd->session_cold, session->index);
+}
+
+/**
+ * @brief make sure n sessions can be created without moving the pool
+ *
+ * The pool grows on demand, up to max_sessions. Growing it moves the
+ * sessions, so the nodes reserve space for a whole frame before they
+ * look up the sessions of the frame. Past max_sessions create_session()
+ * fails anyway, so no more than that is reserved.
+ */
+always_inline void latency_reserve_sessions(latency_per_thread_t * ptd,
+                u32 n) {
+  u32 len = vec_len (ptd->session_pool);
+  u32 max_sessions = latency_main.max_sessions;
+
+  if (PREDICT_FALSE(pool_free_elts (ptd->session_pool) < n
+                    && len < max_sessions)) {
+    /* Grow geometrically, but not past max_sessions */
+    pool_alloc_aligned (ptd->session_pool,
+                        clib_min (clib_max (n, len), max_sessions - len),
+                        CLIB_CACHE_LINE_BYTES);
+  }
+}
+
+/**
+ * @brief observer of a QUIC session, NULL if not allocated yet
+ */
+always_inline quic_observer_t * latency_quic(latency_per_thread_t * ptd,
+                latency_session_t * session) {
+  if (session->observer_index == ~0)
+    return 0;
+  return pool_elt_at_index (ptd->quic_pool, session->observer_index);
+}
+
+/**
+ * @brief observer of a TCP session, NULL if not allocated yet
+ */
+always_inline tcp_observer_t * latency_tcp(latency_per_thread_t * ptd,
+                latency_session_t * session) {
+  if (session->observer_index == ~0)
+    return 0;
+  return pool_elt_at_index (ptd->tcp_pool, session->observer_index);
+}
+
+/**
+ * @brief timestamp observers of a TCP observer, NULL if not allocated yet
+ */
+always_inline tcp_ts_observer_t * latency_tcp_ts(latency_per_thread_t * ptd,
+                tcp_observer_t * tcp) {
+  if (tcp->ts_index == ~0)
+    return 0;
+  return pool_elt_at_index (ptd->tcp_ts_pool, tcp->ts_index);
+}
+
+/**
+ * @brief observer of a PLUS session, NULL if not allocated yet
+ */
+always_inline plus_observer_t * latency_plus(latency_per_thread_t * ptd,
+                latency_session_t * session) {
+  if (session->observer_index == ~0)
     return 0;
-  return pool_elt_at_index (latency_main.session_pool, index);
+  return pool_elt_at_index (ptd->plus_pool, session->observer_index);
+}
+
+/**
+ * @brief prefetch the hash bucket a key maps to
+ */
+always_inline void prefetch_bucket(latency_per_thread_t * ptd,
+                latency_key_t * kv_in) {
+  BVT(clib_bihash) * h = &ptd->latency_table;
+  BVT(clib_bihash_kv) kv;
+  clib_memcpy (kv.key, kv_in->as_u64, sizeof (kv.key));
+  u64 hash = BV(clib_bihash_hash) (&kv);
+  CLIB_PREFETCH (&h->buckets[hash & (h->nbuckets - 1)],
+                 sizeof (h->buckets[0]), LOAD);
+}
+
+/**
+ * @brief batched session lookup
+ *
+ * Prefetches the hash buckets of all keys first, then searches them and
+ * prefetches the session entries, such that the memory latency of one
+ * lookup overlaps with the others. Entries of keys that are NULL are set
+ * to NULL. client_lo receives the LATENCY_KV_CLIENT_LO bit of each found
+ * key. Usable by any node that looks up a frame worth of flows.
+ */
+always_inline void get_sessions_from_keys(latency_per_thread_t * ptd,
+                latency_key_t ** keys, latency_session_t ** sessions,
+                u8 * client_lo, u32 n) {
+  u32 i;
+
+  for (i = 0; i < n; i++) {
+    if (keys[i]) {
+      prefetch_bucket(ptd, keys[i]);
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    sessions[i] = keys[i] ? get_session_from_key(ptd, keys[i], &client_lo[i])
+                          : NULL;
+    if (sessions[i]) {
+      CLIB_PREFETCH (sessions[i], CLIB_CACHE_LINE_BYTES, STORE);
+    }
+  }
+}
+
+/**
+ * @brief prefetch the IPv6 hash bucket a key maps to
+ */
+always_inline void prefetch_bucket6(latency_per_thread_t * ptd,
+                latency_key6_t * kv_in) {
+  clib_bihash_48_8_t * h = &ptd->latency_table6;
+  clib_bihash_kv_48_8_t kv;
+  clib_memcpy (kv.key, kv_in->as_u64, sizeof (kv.key));
+  u64 hash = clib_bihash_hash_48_8 (&kv);
+  CLIB_PREFETCH (&h->buckets[hash & (h->nbuckets - 1)],
+                 sizeof (h->buckets[0]), LOAD);
+}
+
+/**
+ * @brief batched session lookup of IPv6 flows, see get_sessions_from_keys
+ */
+always_inline void get_sessions_from_keys6(latency_per_thread_t * ptd,
+                latency_key6_t ** keys, latency_session_t ** sessions,
+                u8 * client_lo, u32 n) {
+  u32 i;
+
+  for (i = 0; i < n; i++) {
+    if (keys[i]) {
+      prefetch_bucket6(ptd, keys[i]);
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    sessions[i] = keys[i] ? get_session_from_key6(ptd, keys[i], &client_lo[i])
+                          : NULL;
+    if (sessions[i]) {
+      CLIB_PREFETCH (sessions[i], CLIB_CACHE_LINE_BYTES, STORE);
+    }
+  }
 }
 
 /**
  * @brief start a timer in the timer wheel
  */
-always_inline void start_timer(latency_session_t * session, u64 interval) {
-  session->timer = tw_timer_start_2t_1w_2048sl (&latency_main.tw,
+always_inline void start_timer(latency_per_thread_t * ptd,
+                latency_session_t * session, u64 interval) {
+  session->timer = tw_timer_start_2t_1w_2048sl (&ptd->tw,
                    session->index, 0, interval);
 }
 
 /**
  * @brief update the timer
  */
-always_inline void update_timer(latency_session_t * session, u64 interval) {
+always_inline void update_timer(latency_per_thread_t * ptd,
+                latency_session_t * session, u64 interval) {
   if(session->timer != ~0) {
-    tw_timer_stop_2t_1w_2048sl (&latency_main.tw, session->timer);
+    tw_timer_stop_2t_1w_2048sl (&ptd->tw, session->timer);
   }
-  session->timer = tw_timer_start_2t_1w_2048sl (&latency_main.tw,
+  session->timer = tw_timer_start_2t_1w_2048sl (&ptd->tw,
                   session->index, 0, interval);
 }
 
+/* IPv6 extension headers skipped on the way to the L4 header */
+#define LATENCY_IP6_HOP_BY_HOP 0
+#define LATENCY_IP6_ROUTING 43
+#define LATENCY_IP6_FRAGMENT 44
+#define LATENCY_IP6_DST_OPTIONS 60
+#define LATENCY_SIZE_IP6_FRAGMENT 8
+/* Extension headers skipped at most */
+#define LATENCY_IP6_MAX_EXT_HEADERS 8
+
+/**
+ * @brief offset of the L4 header of an IPv6 packet of len bytes
+ *
+ * Skips hop-by-hop, routing, destination options and fragment headers and
+ * sets protocol to the next header after them. If they are truncated, or
+ * the packet is a non-first fragment, which has no L4 header, protocol is
+ * left at the extension header the walk stopped at.
+ */
+always_inline u32 latency_ip6_l4_offset(u8 * data, u32 len, u32 * protocol) {
+  u32 offset = sizeof (ip6_header_t);
+  u8 next = ((ip6_header_t *) data)->protocol;
+  u8 * h;
+  u32 i;
+
+  for (i = 0; i < LATENCY_IP6_MAX_EXT_HEADERS; i++) {
+    h = data + offset;
+    if (next == LATENCY_IP6_FRAGMENT) {
+      /* Fragment offset in the upper 13 bits */
+      if (offset + LATENCY_SIZE_IP6_FRAGMENT > len
+          || clib_net_to_host_u16 (*(u16 *) (h + 2)) >> 3) {
+        break;
+      }
+      offset += LATENCY_SIZE_IP6_FRAGMENT;
+    } else if (next == LATENCY_IP6_HOP_BY_HOP
+               || next == LATENCY_IP6_ROUTING
+               || next == LATENCY_IP6_DST_OPTIONS) {
+      /* Length in 8 bytes, without the first 8 */
+      if (offset + 8 > len || offset + ((h[1] + 1) << 3) > len) {
+        break;
+      }
+      offset += (h[1] + 1) << 3;
+    } else {
+      break;
+    }
+    next = h[0];
+  }
+
+  *protocol = next;
+  return offset;
+}
+
+/**
+ * @brief true for the extension headers latency_ip6_l4_offset skips
+ */
+always_inline bool latency_ip6_is_ext(u32 protocol) {
+  return protocol == LATENCY_IP6_HOP_BY_HOP
+         || protocol == LATENCY_IP6_ROUTING
+         || protocol == LATENCY_IP6_FRAGMENT
+         || protocol == LATENCY_IP6_DST_OPTIONS;
+}
+
 always_inline bool is_quic(u16 src_port, u16 dst_port) {
-  return hash_get(latency_main.hash_quic_ports, src_port)
-          || hash_get(latency_main.hash_quic_ports, dst_port);
+  return clib_bitmap_get_no_check(latency_main.quic_port_bitmap, src_port)
+          || clib_bitmap_get_no_check(latency_main.quic_port_bitmap, dst_port);
+}
+
+/**
+ * @brief true if either port is a NAT port, i.e. the packet may belong
+ * to a tracked flow (forwarding mode)
+ */
+always_inline bool is_nat_port(u16 src_port, u16 dst_port) {
+  return clib_bitmap_get_no_check(latency_main.nat_port_bitmap, src_port)
+          || clib_bitmap_get_no_check(latency_main.nat_port_bitmap, dst_port);
 }
 
 always_inline void get_new_dst(u32 *new_dst_ip, u16 src_port) {
@@ -445,11 +1328,181 @@ always_inline bool comes_after_u32(u32 now, u32 old) {
   return ret < MAX_SKIP;
 }
 
+/**
+ * @brief checksum delta for rewriting both IPs of a packet
+ *
+ * Applies to the IP header checksum and the TCP/UDP checksum alike since
+ * the IPs are part of the pseudo header (RFC 1624).
+ */
+always_inline u16 nat_csum_delta(u32 old_src, u32 old_dst,
+                u32 new_src, u32 new_dst) {
+  ip_csum_t sum = 0;
+  sum = ip_csum_update (sum, old_src, new_src, ip4_header_t, src_address);
+  sum = ip_csum_update (sum, old_dst, new_dst, ip4_header_t, dst_address);
+  return ip_csum_fold (sum);
+}
+
+/**
+ * @brief apply a checksum delta to a checksum field
+ */
+always_inline u16 csum_apply_delta(u16 checksum, u16 delta) {
+  return ip_csum_fold (ip_csum_with_carry (checksum, delta));
+}
+
+/**
+ * @brief NAT-like IP translation
+ *
+ * Returns the checksum delta of the rewrite in delta. The delta
+ * precomputed at session creation is used unless the dst IP differs from
+ * the one it was computed for.
+ */
+always_inline bool ip_nat_translation(ip4_header_t *ip0,
+                latency_session_t * session, u16 * delta) {
+  u32 old_src = ip0->src_address.as_u32;
+  u32 old_dst = ip0->dst_address.as_u32;
+  u32 new_dst;
+
+  if (old_src == session->init_src_ip) {
+    new_dst = session->new_dst_ip;
+    *delta = session->csum_delta_fwd;
+    if (PREDICT_FALSE(old_dst != session->init_dst_ip)) {
+      *delta = nat_csum_delta(old_src, old_dst, session->mb_ip, new_dst);
+    }
+  } else if (old_src == session->new_dst_ip) {
+    new_dst = session->init_src_ip;
+    *delta = session->csum_delta_rev;
+    if (PREDICT_FALSE(old_dst != session->mb_ip)) {
+      *delta = nat_csum_delta(old_src, old_dst, session->mb_ip, new_dst);
+    }
+  } else {
+    return false;
+  }
+
+  ip0->src_address.as_u32 = session->mb_ip;
+  ip0->dst_address.as_u32 = new_dst;
+  return true;
+}
+
+/**
+ * @brief shared memory RTT gauge slot of a session, NULL if not exported
+ */
+always_inline latency_stats_slot_t *
+latency_stats_slot(latency_per_thread_t * ptd, latency_session_t * session) {
+  if (PREDICT_FALSE(!ptd->stats_slots
+      || session->index >= latency_main.stats_slots_per_thread)) {
+    return 0;
+  }
+  return ptd->stats_slots + session->index;
+}
+
+/**
+ * @brief start writing a slot, readers retry until latency_stats_end()
+ *
+ * The release fence keeps the slot stores after the odd sequence number.
+ */
+always_inline void latency_stats_begin(latency_stats_slot_t * slot) {
+  slot->sequence++;
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief publish the slot written since latency_stats_begin()
+ */
+always_inline void latency_stats_end(latency_stats_slot_t * slot) {
+  __atomic_store_n (&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/* The slot columns are in the LATENCY_DIR_* order of the observers */
+STATIC_ASSERT (LATENCY_STATS_CLIENT == LATENCY_DIR_CLIENT
+               && LATENCY_STATS_SERVER == LATENCY_DIR_SERVER,
+               "stats columns must follow the observer directions");
+
+always_inline void latency_stats_rtt(u32 rtt_us[][2], u32 i,
+                u32 rtt_client, u32 rtt_server) {
+  rtt_us[i][LATENCY_DIR_CLIENT] = rtt_client;
+  rtt_us[i][LATENCY_DIR_SERVER] = rtt_server;
+}
+
+/**
+ * @brief publish the packet count and latest RTTs of a session
+ *
+ * Called for every measured packet, the slot is only ever written by the
+ * thread owning the session. The RTTs change far less often than packets
+ * arrive, so the slot is only written (sequence, stores, sequence again)
+ * when an estimator took a new sample. Otherwise the slot line is only
+ * read and stays shared with the collectors.
+ */
+always_inline void latency_stats_update(latency_per_thread_t * ptd,
+                latency_session_t * session, u64 now) {
+  latency_stats_slot_t * slot = latency_stats_slot(ptd, session);
+  /* No signal yet, all RTTs are still 0 */
+  u32 rtt_us[LATENCY_STATS_N_ESTIMATORS][2] = { { 0 } };
+
+  if (!slot) {
+    return;
+  }
+
+  switch (session->observer_index == ~0 ? P_UNKNOWN : session->p_type) {
+    case P_QUIC:
+      {
+        quic_observer_t * q = latency_quic(ptd, session);
+        dyna_heur_spin_observer_t * heur = &q->dyna_heur_spin_observer;
+        latency_stats_rtt(rtt_us, 0, q->basic_spin_observer.rtt[0],
+                          q->basic_spin_observer.rtt[1]);
+        latency_stats_rtt(rtt_us, 1, q->pn_spin_observer.rtt[0],
+                          q->pn_spin_observer.rtt[1]);
+        latency_stats_rtt(rtt_us, 2, q->status_spin_observer.rtt[0],
+                          q->status_spin_observer.rtt[1]);
+        latency_stats_rtt(rtt_us, 3, heur->rtt[0][heur->index[0]],
+                          heur->rtt[1][heur->index[1]]);
+      }
+      break;
+
+    case P_TCP:
+      {
+        tcp_observer_t * t = latency_tcp(ptd, session);
+        tcp_ts_observer_t * ts = latency_tcp_ts(ptd, t);
+        latency_stats_rtt(rtt_us, 0, t->status_spin_observer.rtt[0],
+                          t->status_spin_observer.rtt[1]);
+        if (ts) {
+          latency_stats_rtt(rtt_us, 1, ts->ts_one_RTT_observer.rtt[0],
+                            ts->ts_one_RTT_observer.rtt[1]);
+          latency_stats_rtt(rtt_us, 2, ts->ts_all_RTT_observer.rtt[0],
+                            ts->ts_all_RTT_observer.rtt[1]);
+        }
+        latency_stats_rtt(rtt_us, 3, t->vec_ne_zero.rtt[0],
+                          t->vec_ne_zero.rtt[1]);
+      }
+      break;
+
+    case P_PLUS:
+      {
+        plus_observer_t * pl = latency_plus(ptd, session);
+        latency_stats_rtt(rtt_us, 0, pl->plus_single_observer.rtt[0],
+                          pl->plus_single_observer.rtt[1]);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  if (!memcmp (rtt_us, slot->rtt_us, sizeof (rtt_us))) {
+    return;
+  }
+
+  latency_stats_begin(slot);
+  slot->pkt_count = session->pkt_count;
+  slot->last_time = now;
+  clib_memcpy (slot->rtt_us, rtt_us, sizeof (rtt_us));
+  latency_stats_end(slot);
+}
+
 /**
  * @brief expire timers
  */
-always_inline void expire_timers(f64 now) {
-  tw_timer_expire_timers_2t_1w_2048sl (&latency_main.tw, now);
+always_inline void expire_timers(latency_per_thread_t * ptd, f64 now) {
+  tw_timer_expire_timers_2t_1w_2048sl (&ptd->tw, now);
 }
 
 #define LATENCY_PLUGIN_BUILD_VER "0.1"
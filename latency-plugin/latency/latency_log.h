@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Binary RTT log
+ *
+ * With "latency output binary" the RTT samples are appended as fixed size
+ * records to preallocated, memory mapped segment files
+ * (/tmp/latency_log_<n>.bin, n counting up from 0 at every VPP start)
+ * instead of being formatted as CSV. latency_log_convert turns segments
+ * into CSV or JSON offline. This header is the complete description of
+ * the format.
+ *
+ * Layout: one latency_log_header_t, followed by capacity
+ * latency_log_record_t. Only the first n_records records are valid, a
+ * segment that is still written grows n_records after the records are
+ * complete. Once full, the next segment is started.
+ */
+
+#ifndef __included_latency_log_h__
+#define __included_latency_log_h__
+
+#include <vppinfra/types.h>
+
+#define LATENCY_LOG_PATH_FORMAT "/tmp/latency_log_%u.bin"
+#define LATENCY_LOG_MAGIC 0x4c41544c   /* "LATL" */
+#define LATENCY_LOG_VERSION 1
+
+/* The estimator had a new sample (the *_new column of the CSV output),
+ * otherwise the RTT repeats its last sample */
+#define LATENCY_LOG_FLAG_NEW (1 << 0)
+
+typedef struct {
+  u32 magic;
+  u32 version;
+  /* sizeof (latency_log_record_t) */
+  u32 record_size;
+  u32 pad;
+  /* Records the segment has room for */
+  u64 capacity;
+  /* Valid records */
+  volatile u64 n_records;
+} latency_log_header_t;
+
+typedef struct {
+  /* Flow, unique per VPP run: thread index << 48 | flow number */
+  u64 flow_id;
+  /* VPP time (microseconds) of the packet */
+  u64 time;
+  /* Microseconds */
+  u32 rtt;
+  /* QUIC packet number, TCP sequence number or PLUS packet count */
+  u32 seq;
+  /* sup_protocols_t of latency.h: 0 TCP, 1 QUIC, 2 PLUS */
+  u8 p_type;
+  /* Column of the estimator in the CSV output of the protocol, see
+   * LATENCY_STATS_N_ESTIMATORS in latency_stats.h */
+  u8 estimator;
+  /* 0 client, 1 server */
+  u8 dir;
+  /* LATENCY_LOG_FLAG_* */
+  u8 flags;
+  u32 pad;
+} latency_log_record_t;
+
+#endif /* __included_latency_log_h__ */
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ *------------------------------------------------------------------
+ * latency_log_convert.c - binary RTT log to CSV or JSON
+ *
+ * latency_log_convert [--json] [--new-only] <segment> ...
+ *
+ * Reads segments of the binary RTT log (see latency_log.h) and prints one
+ * line per record to stdout: CSV with a header line by default, one JSON
+ * object per line with --json. --new-only skips the records which only
+ * repeat the last sample of an estimator.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <latency/latency_log.h>
+
+/* Indexed by p_type (sup_protocols_t of latency.h) */
+static const char * protocol_names[] = {"tcp", "quic", "plus"};
+
+/* Estimator names, in the column order of the CSV output of the plugin */
+static const char * estimator_names[][4] = {
+  {"vec", "single_ts_rtt", "all_ts_rtt", "vec_ne_zero"},
+  {"spin", "pn_spin", "vec", "heur"},
+  {"psn_pse", "", "", ""},
+};
+
+static const char * dir_names[] = {"client", "server"};
+
+#define N_PROTOCOLS (sizeof (protocol_names) / sizeof (protocol_names[0]))
+
+static void print_record (latency_log_record_t * r, int json) {
+  const char * protocol = "unknown";
+  const char * estimator = "unknown";
+  const char * dir = r->dir < 2 ? dir_names[r->dir] : "unknown";
+
+  if (r->p_type < N_PROTOCOLS) {
+    protocol = protocol_names[r->p_type];
+    if (r->estimator < 4 && estimator_names[r->p_type][r->estimator][0]) {
+      estimator = estimator_names[r->p_type][r->estimator];
+    }
+  }
+
+  if (json) {
+    printf ("{\"flow_id\":%llu,\"time\":%.6f,\"protocol\":\"%s\","
+            "\"host\":\"%s\",\"estimator\":\"%s\",\"rtt\":%.6f,"
+            "\"seq\":%u,\"new\":%d}\n",
+            (unsigned long long) r->flow_id, r->time * 1e-6, protocol, dir,
+            estimator, r->rtt * 1e-6, r->seq,
+            (r->flags & LATENCY_LOG_FLAG_NEW) != 0);
+  } else {
+    printf ("%llu,%.6f,%s,%s,%s,%.6f,%u,%d\n",
+            (unsigned long long) r->flow_id, r->time * 1e-6, protocol, dir,
+            estimator, r->rtt * 1e-6, r->seq,
+            (r->flags & LATENCY_LOG_FLAG_NEW) != 0);
+  }
+}
+
+/* Returns 0 on success */
+static int convert_segment (const char * path, int json, int new_only) {
+  latency_log_header_t h;
+  latency_log_record_t r;
+  unsigned long long i;
+  FILE * f;
+
+  f = fopen (path, "r");
+  if (!f) {
+    perror (path);
+    return -1;
+  }
+
+  if (fread (&h, sizeof (h), 1, f) != 1 || h.magic != LATENCY_LOG_MAGIC) {
+    fprintf (stderr, "%s: not a latency log segment\n", path);
+    fclose (f);
+    return -1;
+  }
+  if (h.version != LATENCY_LOG_VERSION || h.record_size != sizeof (r)) {
+    fprintf (stderr, "%s: unsupported version %u (record size %u)\n",
+             path, h.version, h.record_size);
+    fclose (f);
+    return -1;
+  }
+
+  for (i = 0; i < h.n_records; i++) {
+    if (fread (&r, sizeof (r), 1, f) != 1) {
+      fprintf (stderr, "%s: truncated after %llu records\n", path, i);
+      fclose (f);
+      return -1;
+    }
+    if (new_only && !(r.flags & LATENCY_LOG_FLAG_NEW)) {
+      continue;
+    }
+    print_record (&r, json);
+  }
+
+  fclose (f);
+  return 0;
+}
+
+int main (int argc, char ** argv) {
+  int json = 0, new_only = 0, n_segments = 0, rv = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp (argv[i], "--json")) {
+      json = 1;
+    } else if (!strcmp (argv[i], "--new-only")) {
+      new_only = 1;
+    } else if (argv[i][0] == '-') {
+      fprintf (stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    } else {
+      n_segments++;
+    }
+  }
+
+  if (!n_segments) {
+    fprintf (stderr,
+             "usage: %s [--json] [--new-only] <segment> ...\n", argv[0]);
+    return 2;
+  }
+
+  if (!json) {
+    printf ("flow_id,time,protocol,host,estimator,rtt,seq,new\n");
+  }
+
+  /* Segments in the given order, e.g. /tmp/latency_log_{0,1,2}.bin */
+  for (i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' && convert_segment (argv[i], json, new_only)) {
+      rv = 1;
+    }
+  }
+  return rv;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Per flow RTT gauges in shared memory
+ *
+ * The plugin publishes the latest RTT estimates of every flow in a
+ * POSIX shared memory object (/dev/shm/latency-stats), such that
+ * collectors can poll them with plain memory reads, without CLI round
+ * trips or barrier syncs. This header is the complete description of the
+ * layout, a collector only needs to mmap the object read-only.
+ *
+ * Layout: one latency_stats_header_t, followed by n_threads blocks of
+ * slots_per_thread latency_stats_slot_t. Each thread owns its block and
+ * uses the slot with the pool index of a session (slots_per_thread is the
+ * max-sessions setting).
+ *
+ * Every slot is guarded by a sequence counter (seqlock): it is odd while
+ * the owning thread writes the slot. A reader copies the slot and only
+ * accepts the copy if the counter was even and unchanged before and after:
+ *
+ *   do {
+ *     seq = slot->sequence;
+ *     copy = *slot;
+ *   } while ((seq & 1) || seq != slot->sequence);
+ *
+ * (with acquire ordering around the copy on weakly ordered CPUs)
+ */
+
+#ifndef __included_latency_stats_h__
+#define __included_latency_stats_h__
+
+#include <vppinfra/types.h>
+#include <vppinfra/cache.h>
+
+#define LATENCY_STATS_SHM_NAME "/latency-stats"
+#define LATENCY_STATS_MAGIC 0x4c415453   /* "LATS" */
+#define LATENCY_STATS_VERSION 3
+
+/* Estimators per flow, in the column order of the CSV output:
+ * QUIC: spin, pn_spin, vec, heur
+ * TCP:  vec, single_ts_rtt, all_ts_rtt, vec_ne_zero
+ * PLUS: psn_pse (others unused) */
+#define LATENCY_STATS_N_ESTIMATORS 4
+
+#define LATENCY_STATS_CLIENT 0
+#define LATENCY_STATS_SERVER 1
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  u32 magic;
+  u32 version;
+  u32 n_threads;
+  u32 slots_per_thread;
+  /* sizeof (latency_stats_slot_t) */
+  u32 slot_size;
+  u32 pad;
+
+  /* VPP time (microseconds) of the last housekeeping run, slot times
+   * use the same time base */
+  volatile u64 now;
+} latency_stats_header_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* Odd while the slot is written, see above */
+  volatile u32 sequence;
+
+  /* Slot holds an active flow */
+  u8 in_use;
+  /* sup_protocols_t of latency.h: 0 TCP, 1 QUIC, 2 PLUS */
+  u8 p_type;
+  u8 is_ip6;
+  /* IP protocol */
+  u8 protocol;
+
+  /* Flow endpoints as in the flow key (network byte order), IPv4
+   * addresses in the first 4 bytes */
+  u8 ip_lo[16];
+  u8 ip_hi[16];
+  u16 port_lo;
+  u16 port_hi;
+
+  /* Packets of the flow up to the last RTT change (the slot is only
+   * written when an RTT changes) */
+  u32 pkt_count;
+
+  /* Session start and the packet of the last RTT change (VPP time in
+   * microseconds), the age of a flow is header->now - start_time */
+  u64 start_time;
+  u64 last_time;
+
+  /* Latest client and server RTT (microseconds) of each estimator, 0 if
+   * the estimator had no sample yet */
+  u32 rtt_us[LATENCY_STATS_N_ESTIMATORS][2];
+} latency_stats_slot_t;
+
+#endif /* __included_latency_stats_h__ */
@@ -23,6 +23,15 @@
 
 /* Register the latency node */
 vlib_node_registration_t latency_node;
+vlib_node_registration_t latency_expire_node;
+vlib_node_registration_t latency_housekeeping_node;
+vlib_node_registration_t latency_ip6_node;
+vlib_node_registration_t latency_quic_node;
+vlib_node_registration_t latency_tcp_node;
+vlib_node_registration_t latency_plus_node;
+vlib_node_registration_t latency_ip6_quic_node;
+vlib_node_registration_t latency_ip6_tcp_node;
+vlib_node_registration_t latency_ip6_plus_node;
 
 /* Used to display LATENCY packets in the packet trace */
 typedef struct {
@@ -32,6 +41,10 @@ typedef struct {
   u32 new_dst_ip;
   u16 type;
   u32 pkt_count;
+  /* IPv6 packets are not NATed, these are the observed addresses */
+  u8 is_ip6;
+  ip6_address_t src_ip6;
+  ip6_address_t dst_ip6;
 } latency_trace_t;
 
 /* packet trace format function */
@@ -47,15 +60,31 @@ static u8 * format_latency_trace (u8 * s, va_list * args) {
   /* show LATENCY packet */
   s = format (s, "LATENCY packet: type: %s\n", typeNames[t->type]);
   s = format (s, "   src port: %u, dst port: %u\n", t->src_port, t->dst_port);
-  s = format (s, "   (new) src ip: %u, (new) dst ip: %u\n", t->new_src_ip, t->new_dst_ip);
+  if (t->is_ip6) {
+    s = format (s, "   src ip: %U, dst ip: %U\n", format_ip6_address,
+                &t->src_ip6, format_ip6_address, &t->dst_ip6);
+  } else {
+    s = format (s, "   (new) src ip: %u, (new) dst ip: %u\n", t->new_src_ip, t->new_dst_ip);
+  }
   s = format (s, "   pkt number in flow: %u\n", t->pkt_count);
 
   return s;
 }
 
-/* Current implementation does not drop any packets */
+/* Node counters for the outcome of a packet. Packets are only dropped
+ * in passive mode, all others are forwarded unchanged */
 #define foreach_latency_error \
-_(TEMP, "Currently not used")
+_(SESSION_CREATED, "sessions created") \
+_(SESSION_EXPIRED, "sessions expired") \
+_(NO_NAT, "new flow without NAT entry for the dst port") \
+_(SHORT_HEADER, "truncated header") \
+_(BAD_TCP_OPTIONS, "bad TCP options") \
+_(QUIC_PN_TYPE, "unknown QUIC packet number type") \
+_(IP6_SKIPPED, "IPv6 packet on the IPv4 arc") \
+_(IP6_NO_L4, "IPv6 non-first fragment or truncated extension headers") \
+_(TABLE_FULL, "session table full, flow not measured") \
+_(NAT_MISMATCH, "IPs match no NAT leg of the flow") \
+_(PASSIVE, "passive mode, consumed packets")
 
 typedef enum {
 #define _(sym,str) LATENCY_ERROR_##sym,
@@ -64,6 +93,24 @@ typedef enum {
   LATENCY_N_ERROR,
 } latency_error_t;
 
+/* No counter for the packet, counted in a spare slot after the others */
+#define LATENCY_ERROR_NONE LATENCY_N_ERROR
+
+/**
+ * @brief add the counts of a frame to the node counters
+ */
+always_inline void
+latency_count_errors (vlib_main_t * vm, vlib_node_runtime_t * node,
+                      u32 * counts) {
+  u32 i;
+
+  for (i = 0; i < LATENCY_N_ERROR; i++) {
+    if (counts[i]) {
+      vlib_node_increment_counter (vm, node->node_index, i, counts[i]);
+    }
+  }
+}
+
 
 static char * latency_error_strings[] = {
 #define _(sym,string) string,
@@ -77,6 +124,7 @@ static char * latency_error_strings[] = {
 
 /* Header sizes in bytes */
 #define SIZE_IP4 20
+#define SIZE_IP6 40
 #define SIZE_UDP 8
 #define SIZE_TCP 20
 #define SIZE_QUIC_MIN 3
@@ -109,8 +157,8 @@ static char * latency_error_strings[] = {
 #define TCP_LATENCY_MASK 0x0E
 #define TCP_LATENCY_SHIFT 1
 
-/* Timeout values (in 100ms) */
-#define TIMEOUT 300
+/* Session idle timeout (in timer ticks), see latency_config */
+#define TIMEOUT (latency_main.session_timeout)
 
 /* PLUS timeouts */
 #define TO_IDLE 100
@@ -120,23 +168,732 @@ static char * latency_error_strings[] = {
 /* We run before IP4_lookup node */
 typedef enum {
   IP4_LOOKUP,
+  LATENCY_NEXT_DROP,
   LATENCY_N_NEXT,
 } latency_next_t;
 
+/* The IPv6 node runs before IP6_lookup node */
+typedef enum {
+  IP6_LOOKUP,
+  LATENCY_IP6_NEXT_DROP,
+  LATENCY_IP6_N_NEXT,
+} latency_ip6_next_t;
+
+/**
+ * @brief parse QUIC short/long header
+ *
+ * Returns false (and sets p->error) if the header is truncated or of
+ * unknown type.
+ */
+always_inline bool
+latency_parse_quic (vlib_buffer_t * b0, latency_packet_t * p) {
+  u32 CLIB_UNUSED(latency_version);
+  u8 *type = vlib_buffer_get_current(b0);
+
+  /* LONG HEADER */
+  /* We expect most packets to have the short header */
+  if (PREDICT_FALSE(*type & IS_LONG)) {
+    if (PREDICT_FALSE(b0->current_length < SIZE_TYPE + SIZE_ID
+                      + SIZE_NUMBER_32 + SIZE_VERSION)) {
+      p->error = LATENCY_ERROR_SHORT_HEADER;
+      return false;
+    }
+    vlib_buffer_advance(b0, SIZE_TYPE);
+    p->total_advance += SIZE_TYPE;
+
+    /* Get connection ID */
+    u64 *temp_id = vlib_buffer_get_current(b0);
+    p->connection_id = clib_net_to_host_u64(*temp_id);
+    vlib_buffer_advance(b0, SIZE_ID);
+    p->total_advance += SIZE_ID;
+
+    /* Get packet number PN */
+    u32* temp_pn = vlib_buffer_get_current(b0);
+    p->packet_number = clib_net_to_host_u32(*temp_pn);
+    vlib_buffer_advance(b0, SIZE_NUMBER_32);
+    p->total_advance += SIZE_NUMBER_32;
+
+    /* Get version */
+    u32 *temp_version = vlib_buffer_get_current(b0);
+    latency_version = clib_net_to_host_u32(*temp_version);
+    vlib_buffer_advance(b0, SIZE_VERSION);
+    p->total_advance += SIZE_VERSION;
+
+  /* SHORT HEADER */
+  } else {
+    vlib_buffer_advance (b0, SIZE_TYPE);
+    p->total_advance += SIZE_TYPE;
+
+    /* No latency version in the short header */
+    latency_version = 0;
+
+    /* Get connection ID */
+    p->connection_id = 0;
+
+    /* Only true for current pinq implementation (IETF draft 05)
+     * For newest IETF draft (08) HAS_ID meaning is reversed */
+    if (*type & HAS_ID && b0->current_length >= SIZE_ID) {
+      u64 *temp_id = vlib_buffer_get_current(b0);
+      p->connection_id = clib_net_to_host_u64(*temp_id);
+
+      vlib_buffer_advance (b0, SIZE_ID);
+      p->total_advance += SIZE_ID;
+    }
+
+    /* Get the packet number */
+    switch (*type & LATENCY_TYPE) {
+      case P_NUMBER_8:
+        if (PREDICT_TRUE(b0->current_length >= SIZE_NUMBER_8)) {
+          u8 *temp_8 = vlib_buffer_get_current(b0);
+          p->packet_number = *temp_8;
+          vlib_buffer_advance (b0, SIZE_NUMBER_8);
+          p->total_advance += SIZE_NUMBER_8;
+        } else {
+          p->error = LATENCY_ERROR_SHORT_HEADER;
+          return false;
+        }
+        break;
+
+      case P_NUMBER_16:
+        if (PREDICT_TRUE(b0->current_length >= SIZE_NUMBER_16)) {
+          u16 *temp_16 = vlib_buffer_get_current(b0);
+          p->packet_number = clib_net_to_host_u16(*temp_16);
+          vlib_buffer_advance (b0, SIZE_NUMBER_16);
+          p->total_advance += SIZE_NUMBER_16;
+        } else {
+          p->error = LATENCY_ERROR_SHORT_HEADER;
+          return false;
+        }
+        break;
+
+      case P_NUMBER_32:
+        if (PREDICT_TRUE(b0->current_length >= SIZE_NUMBER_32)) {
+          u32 *temp_32 = vlib_buffer_get_current(b0);
+          p->packet_number = clib_net_to_host_u32(*temp_32);
+          vlib_buffer_advance (b0, SIZE_NUMBER_32);
+          p->total_advance += SIZE_NUMBER_32;
+        } else {
+          p->error = LATENCY_ERROR_SHORT_HEADER;
+          return false;
+        }
+        break;
+
+      default:
+        p->error = LATENCY_ERROR_QUIC_PN_TYPE;
+        return false;
+    }
+  }
+
+  if (PREDICT_TRUE(b0->current_length >= SIZE_LATENCY_SPIN)) {
+    u8 *temp_m = vlib_buffer_get_current(b0);
+    p->measurement = *temp_m;
+  } else {
+    p->error = LATENCY_ERROR_SHORT_HEADER;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief parse UDP/TCP/QUIC/PLUS headers
+ *
+ * Shared by IPv4 and IPv6, the buffer is at the L4 header. Sets p->p_type
+ * if the packet is tracked, the caller builds the hash key. Only parses
+ * the protocol proto the classifier sorted the packet to, so e.g. the
+ * QUIC port lookup is not repeated.
+ */
+always_inline void
+latency_parse_l4 (vlib_buffer_t * b0, latency_packet_t * p, u8 protocol,
+                  sup_protocols_t proto) {
+  if (proto != P_TCP && protocol == UDP_PROTOCOL
+      && b0->current_length >= SIZE_UDP) {
+    /* Get UDP header */
+    udp_header_t * udp0 = vlib_buffer_get_current(b0);
+    vlib_buffer_advance (b0, SIZE_UDP);
+    p->total_advance += SIZE_UDP;
+    p->udp0 = udp0;
+    p->src_port = udp0->src_port;
+    p->dst_port = udp0->dst_port;
+
+    /* QUIC, either endpoint is on a QUIC port (checked by the classifier) */
+    if (proto == P_QUIC) {
+      if (PREDICT_FALSE(b0->current_length < SIZE_QUIC_MIN)) {
+        p->error = LATENCY_ERROR_SHORT_HEADER;
+      } else if (latency_parse_quic(b0, p)) {
+        p->p_type = P_QUIC;
+      }
+
+    /* PLUS packet */
+    } else if (PREDICT_FALSE(b0->current_length < SIZE_PLUS)) {
+      p->error = LATENCY_ERROR_SHORT_HEADER;
+    } else {
+      plus_header_t *plus0 = vlib_buffer_get_current(b0);
+      vlib_buffer_advance (b0, SIZE_PLUS);
+      p->total_advance += SIZE_PLUS;
+      if (PREDICT_TRUE((plus0->magic_and_flags & MAGIC_MASK) == MAGIC)) {
+        p->plus0 = plus0;
+        p->p_type = P_PLUS;
+      }
+    }
+
+  /* TCP spin and TS */
+  } else if (proto == P_TCP && protocol == TCP_PROTOCOL
+             && b0->current_length >= SIZE_TCP) {
+    /* Get TCP header */
+    tcp_header_t * tcp0 = vlib_buffer_get_current(b0);
+    vlib_buffer_advance (b0, SIZE_TCP);
+    p->total_advance += SIZE_TCP;
+    p->tcp0 = tcp0;
+    p->is_udp = false;
+    p->src_port = tcp0->src_port;
+    p->dst_port = tcp0->dst_port;
+
+    /* For timestamp values */
+    p->tsval = 0;
+    p->tsecr = 0;
+
+    if (tcp_options_parse_mod(tcp0, &p->tsval, &p->tsecr)) {
+      p->error = LATENCY_ERROR_BAD_TCP_OPTIONS;
+      return;
+    }
+
+    /* Ignore SYN ACK packets, no VEC  */
+    if (PREDICT_FALSE(tcp_syn(tcp0) && tcp_ack(tcp0))) {
+      p->make_measurement = false;
+    }
+
+    /* VEC data from reserved space */
+    p->measurement = (tcp0->data_offset_and_reserved & TCP_LATENCY_MASK)
+            >> TCP_LATENCY_SHIFT;
+
+    p->p_type = P_TCP;
+
+  /* The protocol was checked by the classifier */
+  } else {
+    p->error = LATENCY_ERROR_SHORT_HEADER;
+  }
+}
+
+/**
+ * @brief parse IP/UDP/TCP/QUIC/PLUS headers and build the hash key
+ *
+ * Leaves p->p_type at P_UNKNOWN for packets we do not track.
+ * The buffer is advanced by p->total_advance in any case.
+ */
+always_inline void
+latency_parse_packet (vlib_buffer_t * b0, latency_packet_t * p, int is_ip6,
+                      sup_protocols_t proto) {
+  p->p_type = P_UNKNOWN;
+  p->error = LATENCY_ERROR_NONE;
+  p->total_advance = 0;
+  p->make_measurement = true;
+  p->is_udp = true;
+  p->ip0 = NULL;
+  p->ip60 = NULL;
+  p->udp0 = NULL;
+  p->tcp0 = NULL;
+  p->plus0 = NULL;
+
+  if (is_ip6) {
+    if (PREDICT_FALSE(b0->current_length < SIZE_IP6)) {
+      p->error = LATENCY_ERROR_SHORT_HEADER;
+      return;
+    }
+
+    /* Get IP6 header and skip the extension headers */
+    ip6_header_t *ip60 = vlib_buffer_get_current(b0);
+    u32 protocol;
+    u32 l3_size = latency_ip6_l4_offset((u8 *) ip60, b0->current_length,
+                                        &protocol);
+    vlib_buffer_advance (b0, l3_size);
+    p->total_advance += l3_size;
+    p->ip60 = ip60;
+
+    latency_parse_l4(b0, p, protocol, proto);
+
+    if (p->p_type == P_PLUS) {
+      p->src_lo = make_plus_key6(&p->kv6, &ip60->src_address,
+                     &ip60->dst_address, p->src_port, p->dst_port,
+                     protocol, p->plus0->CAT);
+    } else if (p->p_type != P_UNKNOWN) {
+      p->src_lo = make_key6(&p->kv6, &ip60->src_address, &ip60->dst_address,
+                p->src_port, p->dst_port, protocol);
+    }
+    return;
+  }
+
+  if (PREDICT_FALSE(b0->current_length < SIZE_IP4)) {
+    p->error = LATENCY_ERROR_SHORT_HEADER;
+    return;
+  }
+
+  /* Get IP4 header */
+  // TODO: add support for IP options
+  ip4_header_t *ip0 = vlib_buffer_get_current(b0);
+  vlib_buffer_advance (b0, SIZE_IP4);
+  p->total_advance += SIZE_IP4;
+  p->ip0 = ip0;
+
+  /* IPv6 packets are handled by the latency-ip6 node */
+  if (PREDICT_FALSE((ip0->ip_version_and_header_length & 0xF0) == 0x60)) {
+    p->error = LATENCY_ERROR_IP6_SKIPPED;
+    return;
+  }
+
+  latency_parse_l4(b0, p, ip0->protocol, proto);
+
+  if (p->p_type == P_PLUS) {
+    p->src_lo = make_plus_key(&p->kv, ip0->src_address.as_u32,
+                  ip0->dst_address.as_u32, p->src_port, p->dst_port,
+                  ip0->protocol, p->plus0->CAT);
+  } else if (p->p_type != P_UNKNOWN) {
+    p->src_lo = make_key(&p->kv, ip0->src_address.as_u32,
+             ip0->dst_address.as_u32, p->src_port, p->dst_port,
+             ip0->protocol);
+  }
+}
+
+/**
+ * @brief create a session for the first packet of a flow
+ *
+ * Returns NULL if the dst port has no NAT entry. IPv6 flows are not
+ * NATed, but are only tracked towards the same known dst ports. In
+ * passive mode all flows are tracked, keyed on the observed tuple only.
+ */
+always_inline latency_session_t *
+latency_new_session (latency_per_thread_t * ptd, latency_packet_t * p,
+                     int is_ip6, int is_passive, u32 * counts) {
+  u16 src_port = p->src_port;
+  u16 dst_port = p->dst_port;
+  u64 cat = 0;
+
+  /* Only consider flows for known dst (dst port) */
+  u32 new_dst_ip = 0;
+  if (!is_passive) {
+    get_new_dst(&new_dst_ip, dst_port);
+    if (!new_dst_ip) {
+      counts[LATENCY_ERROR_NO_NAT]++;
+      return NULL;
+    }
+  }
+
+  /* Create new session */
+  u32 index = create_session(ptd, p->p_type);
+  if (PREDICT_FALSE(index == ~0)) {
+    counts[LATENCY_ERROR_TABLE_FULL]++;
+    return NULL;
+  }
+  latency_session_t * session = get_latency_session(ptd, index);
+  latency_session_cold_t * cold = get_latency_session_cold(ptd, session);
+
+  if (p->p_type == P_PLUS) {
+    cat = p->plus0->CAT;
+  }
+
+  session->init_src_port = src_port;
+  session->pkt_count = 1;
+
+  if (is_ip6) {
+    /* Both directions match the same key */
+    session->is_ip6 = 1;
+    cold->key6 = p->kv6;
+    if (PREDICT_FALSE(update_state6(ptd, &p->kv6,
+                      latency_kv_value(session->index, p->src_lo)))) {
+      goto table_full;
+    }
+
+    start_timer(ptd, session, TIMEOUT);
+    return session;
+  }
+
+  ip4_header_t * ip0 = p->ip0;
+
+  /* Save key for reverse lookup */
+  cold->key = p->kv;
+
+  /* No NAT, both directions match the same key. The NAT fields stay
+   * zero, ip_nat_translation never matches such a session */
+  if (is_passive) {
+    if (PREDICT_FALSE(update_state(ptd, &p->kv,
+                      latency_kv_value(session->index, p->src_lo)))) {
+      goto table_full;
+    }
+    start_timer(ptd, session, TIMEOUT);
+    return session;
+  }
+
+  /* Initialize values */
+  session->init_src_ip = ip0->src_address.as_u32;
+  session->new_dst_ip = new_dst_ip;
+  session->init_dst_ip = ip0->dst_address.as_u32;
+  session->mb_ip = latency_main.mb_ip;
+
+  /* Checksum deltas of the NAT rewrite for both legs */
+  session->csum_delta_fwd = nat_csum_delta(session->init_src_ip,
+                  session->init_dst_ip, session->mb_ip, new_dst_ip);
+  session->csum_delta_rev = nat_csum_delta(new_dst_ip, session->mb_ip,
+                  session->mb_ip, session->init_src_ip);
+  if (PREDICT_FALSE(update_state(ptd, &p->kv,
+                    latency_kv_value(session->index, p->src_lo)))) {
+    goto table_full;
+  }
+
+  /* Packets in reverse direction will get same session
+   * Necessary because we rewrite the IPs. The client faces the server
+   * through the (MB, client port) endpoint */
+  latency_key_t kv;
+  u8 client_lo;
+  if (p->p_type == P_PLUS) {
+    client_lo = make_plus_key(&kv, 0, new_dst_ip, src_port, dst_port,
+                              ip0->protocol, cat);
+  } else {
+    client_lo = make_key(&kv, 0, new_dst_ip, src_port, dst_port,
+                         ip0->protocol);
+  }
+  cold->key_reverse = kv;
+  if (PREDICT_FALSE(update_state(ptd, &kv,
+                    latency_kv_value(session->index, client_lo)))) {
+    abort_session(ptd, session, 1 /* key_added */);
+    counts[LATENCY_ERROR_TABLE_FULL]++;
+    return NULL;
+  }
+
+  start_timer(ptd, session, TIMEOUT);
+
+  return session;
+
+table_full:
+  /* Out of hash memory before any key was added */
+  abort_session(ptd, session, 0 /* key_added */);
+  counts[LATENCY_ERROR_TABLE_FULL]++;
+  return NULL;
+}
+
+/**
+ * @brief prefetch the observer block of a session
+ */
+always_inline void
+latency_prefetch_observer (latency_per_thread_t * ptd,
+                           latency_session_t * session) {
+  if (session->observer_index == ~0) {
+    return;
+  }
+  switch (session->p_type) {
+    case P_QUIC:
+      CLIB_PREFETCH (latency_quic(ptd, session), 2 * CLIB_CACHE_LINE_BYTES,
+                     STORE);
+      break;
+    case P_TCP:
+      CLIB_PREFETCH (latency_tcp(ptd, session), 2 * CLIB_CACHE_LINE_BYTES,
+                     STORE);
+      break;
+    case P_PLUS:
+      CLIB_PREFETCH (latency_plus(ptd, session), CLIB_CACHE_LINE_BYTES,
+                     STORE);
+      break;
+    default:
+      break;
+  }
+}
+
 /**
- * @brief Main loop function
+ * @brief RTT estimation, NAT and checksum update for one parsed packet
+ *
+ * session is the result of the hash lookup (NULL for new flows).
+ * In passive mode the packet is not modified at all. Outcomes are counted
+ * in counts, indexed by latency_error_t.
+ */
+always_inline void
+latency_process_packet (vlib_main_t * vm, vlib_node_runtime_t * node,
+                        latency_per_thread_t * ptd,
+                        vlib_buffer_t * b0, latency_packet_t * p,
+                        latency_session_t * session, u64 now, int is_ip6,
+                        int is_passive, sup_protocols_t proto,
+                        u32 * counts) {
+  ip4_header_t * ip0 = p->ip0;
+  udp_header_t * udp0 = p->udp0;
+  tcp_header_t * tcp0 = p->tcp0;
+
+  if (p->p_type == P_UNKNOWN) {
+    goto skip_packet;
+  }
+
+  /* Only for the first packet of a flow we do not have a matching session */
+  if (PREDICT_FALSE(!session)) {
+    /* All lookups of a frame are done up front, an earlier packet of the
+     * same frame may have created the session in the meantime */
+    u8 client_lo;
+    session = is_ip6 ? get_session_from_key6(ptd, &p->kv6, &client_lo)
+                     : get_session_from_key(ptd, &p->kv, &client_lo);
+    if (session) {
+      p->dir = p->src_lo ^ client_lo;
+    } else {
+      session = latency_new_session(ptd, p, is_ip6, is_passive, counts);
+      if (!session) {
+        goto skip_packet;
+      }
+      /* The first packet of a flow comes from the client */
+      p->dir = LATENCY_DIR_CLIENT;
+      latency_count_session(ptd, session, 1);
+      latency_stats_session_open(ptd, session, now);
+      counts[LATENCY_ERROR_SESSION_CREATED]++;
+    }
+  }
+
+  /* The observers are created once the flow carries a signal */
+  switch (proto) {
+    case P_QUIC:
+      {
+        quic_observer_t * quic = latency_quic(ptd, session);
+        bool first = false;
+
+        if (!quic) {
+          /* Neither spin bit nor VEC set so far */
+          if (!(p->measurement & (ONE_BIT_SPIN | STATUS_MASK))) {
+            break;
+          }
+          quic = create_quic_observer(ptd, session);
+          quic->id = p->connection_id;
+          first = true;
+        }
+
+        /* Do latency RTT estimation */
+        update_quic_rtt_estimate(vm, quic, now, p->dir, p->measurement,
+                      p->packet_number, first);
+      }
+      break;
+
+    case P_PLUS:
+      {
+        plus_header_t * plus0 = p->plus0;
+        plus_observer_t * plus = latency_plus(ptd, session);
+
+        /* Every PLUS packet carries a PSN */
+        if (!plus) {
+          plus = create_plus_observer(ptd, session);
+          plus->cat = plus0->CAT;
+        }
+
+        /* Do PLUS PSN PSE RTT estimation */
+        update_plus_rtt_estimate(vm, plus, now, p->dir,
+                      clib_net_to_host_u32(plus0->PSN),
+                      clib_net_to_host_u32(plus0->PSE),
+                      clib_net_to_host_u64(plus0->CAT),
+                      session->pkt_count);
+
+        /* Handle extended header */
+        plus_ext_hop_c_h_t *plus_ext_hop_c0;
+
+        /* Enough space for extended header */
+        /* The hop count is not increased in passive mode */
+        if (!is_passive && (plus0->magic_and_flags & EXTENDED)
+            && b0->current_length >= SIZE_PLUS + SIZE_PLUS_EXT_HELLO) {
+          plus_ext_hop_c0 = vlib_buffer_get_current(b0);
+
+          u8 ii = plus_ext_hop_c0->PCF_len_and_II & 0x03;
+          /* "Hop count" header */
+          if (plus_ext_hop_c0->PCF_type == 1 && ii == 0) {
+            u8 old_hop_c = plus_ext_hop_c0->PCF_hop_c;
+            plus_ext_hop_c0->PCF_hop_c += 1;
+
+            /* Incremental UDP checksum update, 0 means no checksum */
+            if (udp0->checksum) {
+              ip_csum_t sum0 = udp0->checksum;
+              sum0 = ip_csum_update (sum0, old_hop_c,
+                                     plus_ext_hop_c0->PCF_hop_c,
+                                     plus_ext_hop_c_h_t, PCF_hop_c);
+              udp0->checksum = ip_csum_fold (sum0);
+            }
+          }
+        }
+      }
+      break;
+
+    case P_TCP:
+      /* Do timestamp and latency RTT estimation */
+      if (PREDICT_TRUE(p->make_measurement)) {
+        tcp_observer_t * tcp = latency_tcp(ptd, session);
+        tcp_ts_observer_t * ts;
+        bool first = false;
+
+        if (!tcp) {
+          /* Neither VEC bits nor timestamps so far */
+          if (!p->measurement && !p->tsval) {
+            break;
+          }
+          tcp = create_tcp_observer(ptd, session);
+          first = true;
+        }
+        ts = latency_tcp_ts(ptd, tcp);
+        if (!ts && p->tsval) {
+          ts = create_tcp_ts_observer(ptd, tcp);
+        }
+
+        update_tcp_rtt_estimate(vm, tcp, ts, now, p->dir, p->measurement,
+                  p->tsval, p->tsecr, first,
+                  clib_net_to_host_u32(tcp0->seq_number));
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  /* Keep track of packets for each flow */
+  session->pkt_count ++;
+  latency_stats_update(ptd, session, now);
+
+  /* NAT-like IP translation, IPv6 packets are forwarded unchanged */
+  if (!is_ip6 && !is_passive) {
+    u16 csum_delta;
+    if (!ip_nat_translation(ip0, session, &csum_delta)) {
+      counts[LATENCY_ERROR_NAT_MISMATCH]++;
+      goto skip_packet;
+    }
+
+    /* Incremental UDP/TCP and IP checksum update (RFC 1624), the IPs are
+     * part of the pseudo header. A zero UDP checksum means no checksum */
+    if (p->is_udp) {
+      if (udp0->checksum) {
+        udp0->checksum = csum_apply_delta(udp0->checksum, csum_delta);
+      }
+    } else {
+      tcp0->checksum = csum_apply_delta(tcp0->checksum, csum_delta);
+    }
+    ip0->checksum = csum_apply_delta(ip0->checksum, csum_delta);
+  }
+
+  /* Currently only ACTIVE and ERROR state
+   * The timer is just used to free memory if flow is no longer observed
+   * PLUS states not implemented at the moment */
+  switch ((latency_state_t) session->state) {
+    case LATENCY_STATE_ACTIVE:
+      update_timer(ptd, session, TIMEOUT);
+    break;
+
+    case LATENCY_STATE_ERROR:
+    break;
+
+    default:
+    break;
+  }
+
+  /* If packet trace is active */
+  if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)
+      && (b0->flags & VLIB_BUFFER_IS_TRACED))) {
+
+    latency_trace_t *t = vlib_add_trace (vm, node, b0, sizeof (*t));
+    if (p->is_udp) {
+      t->src_port = clib_net_to_host_u16(udp0->src_port);
+      t->dst_port = clib_net_to_host_u16(udp0->dst_port);
+    } else {
+      t->src_port = clib_net_to_host_u16(tcp0->src_port);
+      t->dst_port = clib_net_to_host_u16(tcp0->dst_port);
+    }
+    t->is_ip6 = is_ip6;
+    if (is_ip6) {
+      t->src_ip6 = p->ip60->src_address;
+      t->dst_ip6 = p->ip60->dst_address;
+    } else {
+      t->new_src_ip = clib_net_to_host_u32(ip0->src_address.as_u32);
+      t->new_dst_ip = clib_net_to_host_u32(ip0->dst_address.as_u32);
+    }
+    t->type = session->p_type;
+    t->pkt_count = session->pkt_count;
+  }
+
+  /* Move buffer pointer back such that next node gets expected position */
+skip_packet:
+  vlib_buffer_advance (b0, -p->total_advance);
+}
+
+/**
+ * @brief Main loop of the protocol nodes
+ *
+ * Specialized per address family, protocol and mode, every protocol node
+ * only gets the packets the classifier sorted to it.
+ *
+ * Expired sessions are reclaimed by the latency-expire node, the packet
+ * loop only does lookups and estimator updates.
+ *
+ * The frame is processed in three stages such that the memory latency of
+ * the different packets overlaps:
+ * 1. parse all packets and build their hash keys (prefetching buffers)
+ * 2. batched session lookup, see get_sessions_from_keys(), which also
+ *    resolves the direction of each packet
+ * 3. RTT estimation, NAT and checksum update in a dual loop which
+ *    prefetches the observer blocks of the next pair
+ *
+ * In passive mode stage 3 only does the RTT estimation, all packets are
+ * dropped afterwards.
  * */
-static uword
-latency_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
-                 vlib_frame_t * frame) {
-  
+always_inline uword
+latency_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
+                vlib_frame_t * frame, int is_ip6, int is_passive,
+                sup_protocols_t proto) {
+
   u32 n_left_from, * from, * to_next;
   latency_next_t next_index;
+  latency_per_thread_t * ptd = get_per_thread (vm->thread_index);
+  latency_packet_t * pkts = ptd->pkts, * p;
+  latency_key_t ** keys = ptd->keys;
+  latency_key6_t ** keys6 = ptd->keys6;
+  latency_session_t ** sessions = ptd->sessions, ** s;
+  u8 * client_lo = ptd->client_lo;
+  u32 counts[LATENCY_N_ERROR + 1] = { 0 };
+  u32 i;
+  /* Same index for the IPv4 and IPv6 node */
+  u32 next = is_passive ? LATENCY_NEXT_DROP : IP4_LOOKUP;
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors;
   next_index = node->cached_next_index;
 
+  u64 now = latency_time_now_us (vm);
+
+  /* Stage 1: parse headers and build the hash keys */
+  for (i = 0; i < n_left_from; i++) {
+    vlib_buffer_t * b0;
+
+    if (PREDICT_TRUE(i + 2 < n_left_from)) {
+      vlib_buffer_t * b2 = vlib_get_buffer (vm, from[i + 2]);
+      vlib_prefetch_buffer_header (b2, LOAD);
+      /* IP, L4 and QUIC/PLUS header span two cache lines */
+      CLIB_PREFETCH (b2->data, 2 * CLIB_CACHE_LINE_BYTES, STORE);
+    }
+
+    b0 = vlib_get_buffer (vm, from[i]);
+    latency_parse_packet(b0, &pkts[i], is_ip6, proto);
+    counts[pkts[i].error]++;
+    if (is_ip6) {
+      keys6[i] = pkts[i].p_type != P_UNKNOWN ? &pkts[i].kv6 : NULL;
+    } else {
+      keys[i] = pkts[i].p_type != P_UNKNOWN ? &pkts[i].kv : NULL;
+    }
+  }
+
+  /* Stage 2: batched session lookup
+   * New sessions of stage 3 must not move the pool under the sessions
+   * looked up here */
+  latency_reserve_sessions(ptd, n_left_from);
+  if (is_ip6) {
+    get_sessions_from_keys6(ptd, keys6, sessions, client_lo, n_left_from);
+  } else {
+    get_sessions_from_keys(ptd, keys, sessions, client_lo, n_left_from);
+  }
+
+  /* Resolve the direction once, the estimators index their per direction
+   * state with it instead of comparing ports */
+  for (i = 0; i < n_left_from; i++) {
+    if (sessions[i]) {
+      pkts[i].dir = pkts[i].src_lo ^ client_lo[i];
+    }
+  }
+
+  /* Stage 3: estimation, NAT and checksum */
+  p = pkts;
+  s = sessions;
+
   while (n_left_from > 0) {
 
     u32 n_left_to_next;
@@ -144,16 +901,52 @@ latency_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
     vlib_get_next_frame (vm, node, next_index,
                          to_next, n_left_to_next);
 
-    /* Currently, only single loop implemented 
-     * TODO: implement double loop */
-    while (n_left_from > 0 && n_left_to_next > 0) {
+    while (n_left_from >= 4 && n_left_to_next >= 2) {
+
+      u32 bi0, bi1;
+      vlib_buffer_t * b0, * b1;
+      u32 next0 = next, next1 = next;
+
+      /* Prefetch observers of the next iteration */
+      if (s[2]) {
+        latency_prefetch_observer(ptd, s[2]);
+      }
+      if (s[3]) {
+        latency_prefetch_observer(ptd, s[3]);
+      }
+
+      /* speculatively enqueue b0 and b1 to the current next frame */
+      to_next[0] = bi0 = from[0];
+      to_next[1] = bi1 = from[1];
+      from += 2;
+      to_next += 2;
+      n_left_from -= 2;
+      n_left_to_next -= 2;
+
+      b0 = vlib_get_buffer (vm, bi0);
+      b1 = vlib_get_buffer (vm, bi1);
+
+      latency_process_packet(vm, node, ptd, b0, &p[0], s[0], now, is_ip6,
+                             is_passive, proto, counts);
+      latency_process_packet(vm, node, ptd, b1, &p[1], s[1], now, is_ip6,
+                             is_passive, proto, counts);
+      if (is_passive) {
+        b0->error = b1->error = node->errors[LATENCY_ERROR_PASSIVE];
+      }
+      p += 2;
+      s += 2;
 
-      /* Advance timer wheel */
-      expire_timers(vlib_time_now (vm));
+      /* verify speculative enqueues, maybe switch current next frame */
+      vlib_validate_buffer_enqueue_x2 (vm, node, next_index,
+                                       to_next, n_left_to_next,
+                                       bi0, bi1, next0, next1);
+    }
+
+    while (n_left_from > 0 && n_left_to_next > 0) {
 
       u32 bi0;
       vlib_buffer_t * b0;
-      u32 next0 = 0;
+      u32 next0 = next;
 
       /* speculatively enqueue b0 to the current next frame */
       bi0 = from[0];
@@ -165,435 +958,541 @@ latency_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
 
       b0 = vlib_get_buffer (vm, bi0);
 
-      /* Keeps track of all the buffer movement */
-      u8 total_advance = 0;
-      bool make_measurement = true;
-      bool is_udp = true;
+      latency_process_packet(vm, node, ptd, b0, &p[0], s[0], now, is_ip6,
+                             is_passive, proto, counts);
+      if (is_passive) {
+        b0->error = node->errors[LATENCY_ERROR_PASSIVE];
+      }
+      p += 1;
+      s += 1;
 
-      /* Contains TCP, QUIC or PLUS session */
-      latency_session_t * session = NULL;
+      /* verify speculative enqueue, maybe switch current next frame */
+      vlib_validate_buffer_enqueue_x1 (vm, node, next_index, to_next,
+                                       n_left_to_next, bi0, next0);
+    }
 
-      udp_header_t * udp0 = NULL;
-      tcp_header_t * tcp0 = NULL;
+    vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+  }
 
-      if (PREDICT_TRUE(b0->current_length >= SIZE_IP4)) {
+  latency_count_errors (vm, node, counts);
 
-        /* Get IP4 header */
-        // TODO: add support for IP options and IPv6 headers
-        ip4_header_t *ip0 = vlib_buffer_get_current(b0);
-        vlib_buffer_advance (b0, SIZE_IP4);
-        total_advance += SIZE_IP4;
+  return frame->n_vectors;
+}
 
-        /* Ignore IPv6 packets */
-        if (PREDICT_FALSE((ip0->ip_version_and_header_length & 0xF0) == 0x60)) {
-          goto skip_packet;
-        }
+/* One node function per address family and protocol */
+#define foreach_latency_proto_node \
+_(quic, QUIC, 0) \
+_(tcp, TCP, 0) \
+_(plus, PLUS, 0) \
+_(ip6_quic, QUIC, 1) \
+_(ip6_tcp, TCP, 1) \
+_(ip6_plus, PLUS, 1)
+
+#define _(n,p,is_ip6)                                                     \
+static uword                                                              \
+latency_##n##_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,      \
+                       vlib_frame_t * frame) {                            \
+  if (latency_main.passive) {                                             \
+    return latency_inline (vm, node, frame, is_ip6, 1, P_##p);            \
+  }                                                                       \
+  return latency_inline (vm, node, frame, is_ip6, 0, P_##p);              \
+}
+foreach_latency_proto_node
+#undef _
 
-        if (ip0->protocol == UDP_PROTOCOL && b0->current_length >= SIZE_UDP) {
-          /* Get UDP header */
-          udp0 = vlib_buffer_get_current(b0);
-          vlib_buffer_advance (b0, SIZE_UDP);
-          total_advance += SIZE_UDP;
-          is_udp = true;
-
-          /* QUIC "detection", see if either endpoint is on the QUIC_PORT */
-          if (is_quic(udp0->src_port, udp0->dst_port) &&
-              b0->current_length >= SIZE_QUIC_MIN) {
-              
-            /* Get QUIC header */
-            u64 connection_id;
-            u32 packet_number, CLIB_UNUSED(latency_version);
-            u8 *type = vlib_buffer_get_current(b0);
-
-            /* LONG HEADER */
-            /* We expect most packets to have the short header */
-            if (PREDICT_FALSE(*type & IS_LONG)) {
-              vlib_buffer_advance(b0, SIZE_TYPE);
-              total_advance += SIZE_TYPE;
-
-              /* Get connection ID */
-              u64 *temp_id = vlib_buffer_get_current(b0);
-              connection_id = clib_net_to_host_u64(*temp_id);
-              vlib_buffer_advance(b0, SIZE_ID);
-              total_advance += SIZE_ID;
-
-              /* Get packet number PN */
-              u32* temp_pn = vlib_buffer_get_current(b0);
-              packet_number = clib_net_to_host_u32(*temp_pn);
-              vlib_buffer_advance(b0, SIZE_NUMBER_32);
-              total_advance += SIZE_NUMBER_32;
-
-              /* Get version */
-              u32 *temp_version = vlib_buffer_get_current(b0);
-              latency_version = clib_net_to_host_u32(*temp_version);
-              vlib_buffer_advance(b0, SIZE_VERSION);
-              total_advance += SIZE_VERSION;
-
-            /* SHORT HEADER */
-            } else {
-              vlib_buffer_advance (b0, SIZE_TYPE);
-              total_advance += SIZE_TYPE;
-
-              /* No latency version in the short header */
-              latency_version = 0;
-
-              /* Get connection ID */
-              connection_id = 0;
-              
-              /* Only true for current pinq implementation (IETF draft 05)
-               * For newest IETF draft (08) HAS_ID meaning is reversed */
-              if (*type & HAS_ID && b0->current_length >= SIZE_ID) {
-                u64 *temp_id = vlib_buffer_get_current(b0);
-                connection_id = clib_net_to_host_u64(*temp_id);
-
-                vlib_buffer_advance (b0, SIZE_ID);
-                total_advance += SIZE_ID;
-              }
-
-              /* Get the packet number */
-              switch (*type & LATENCY_TYPE) {
-                case P_NUMBER_8:
-                  if (PREDICT_TRUE(b0->current_length >= SIZE_NUMBER_8)) {
-                    u8 *temp_8 = vlib_buffer_get_current(b0);
-                    packet_number = *temp_8;
-                    vlib_buffer_advance (b0, SIZE_NUMBER_8);
-                    total_advance += SIZE_NUMBER_8;
-                  } else {
-                    goto skip_packet;
-                  }
-                  break;
-
-                case P_NUMBER_16:
-                  if (PREDICT_TRUE(b0->current_length >= SIZE_NUMBER_16)) {
-                    u16 *temp_16 = vlib_buffer_get_current(b0);
-                    packet_number = clib_net_to_host_u16(*temp_16);
-                    vlib_buffer_advance (b0, SIZE_NUMBER_16);
-                    total_advance += SIZE_NUMBER_16;
-                  } else {
-                    goto skip_packet;
-                  }
-                  break;
-
-                case P_NUMBER_32:
-                  if (PREDICT_TRUE(b0->current_length >= SIZE_NUMBER_32)) {
-                    u32 *temp_32 = vlib_buffer_get_current(b0);
-                    packet_number = clib_net_to_host_u32(*temp_32);
-                    vlib_buffer_advance (b0, SIZE_NUMBER_32);
-                    total_advance += SIZE_NUMBER_32;
-                  } else {
-                    goto skip_packet;
-                  }
-                  break;
-
-                default:
-                  goto skip_packet;
-              }
-            }
+VLIB_REGISTER_NODE (latency_quic_node) = {
+  .function = latency_quic_node_fn,
+  .name = "latency-quic",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
 
-            u8 measurement;
-            if (PREDICT_TRUE(b0->current_length >= SIZE_LATENCY_SPIN)) {
-              u8 *temp_m = vlib_buffer_get_current(b0);
-              measurement = *temp_m;
-            } else {
-              goto skip_packet;
-            }
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
 
-            latency_key_t kv;
-
-            make_key(&kv, ip0->src_address.as_u32, ip0->dst_address.as_u32, udp0->src_port,
-                     udp0->dst_port, ip0->protocol);
-
-            /* Try to get a session for the key */
-            session = get_session_from_key(&kv);
-
-            /* Only for the first packet of a flow we do not have a matching session */
-            if (PREDICT_FALSE(!session)) {
-              
-              /* Only consider flows for known dst (dst port) */
-              u32 new_dst_ip;
-              get_new_dst(&new_dst_ip, udp0->dst_port);
-              if (!new_dst_ip) {
-                goto skip_packet;
-              }
-
-              /* Create new session */
-              u32 index = create_session(P_QUIC);
-              session = get_latency_session(index);
-
-              /* Save key for reverse lookup */
-              session->key = kv.as_u64;
-
-              /* Initialize values */
-              session->quic->id = connection_id;
-              session->init_src_port = udp0->src_port;
-              session->init_src_ip = ip0->src_address.as_u32;
-              session->new_dst_ip = new_dst_ip;
-              
-              update_state(&kv, session->index);
-
-              /* Packets in reverse direction will get same session
-               * Necessary because we rewrite the IPs */
-              make_key(&kv, 0, new_dst_ip, udp0->src_port,
-                       udp0->dst_port, ip0->protocol);
-              update_state(&kv, session->index);
-              
-              session->key_reverse = kv.as_u64;
-              
-              session->pkt_count = 1;
-
-              start_timer(session, TIMEOUT);
-            }
+  .n_next_nodes = LATENCY_N_NEXT,
 
-            /* Do latency RTT estimation */
-            update_quic_rtt_estimate(vm, session->quic, vlib_time_now (vm),
-                          udp0->src_port, session->init_src_port, measurement,
-                          packet_number, session->pkt_count);
-
-          /* PLUS packet */
-          } else {
-            if (b0->current_length >= SIZE_PLUS) {
-              plus_header_t *plus0 = vlib_buffer_get_current(b0);
-              vlib_buffer_advance (b0, SIZE_PLUS);
-              total_advance += SIZE_PLUS;
-              if (PREDICT_TRUE((plus0->magic_and_flags & MAGIC_MASK) == MAGIC)) {
-                latency_key_t kv;
-                make_plus_key(&kv, ip0->src_address.as_u32, ip0->dst_address.as_u32,
-                                udp0->src_port, udp0->dst_port, ip0->protocol,
-                                plus0->CAT);
-                
-                session = get_session_from_key(&kv);
-
-                if (PREDICT_FALSE(!session)) {
-
-                  /* Only consider flows for known dst (dst port) */
-                  u32 new_dst_ip;
-                  get_new_dst(&new_dst_ip, udp0->dst_port);
-                  if (!new_dst_ip) {
-                    goto skip_packet;
-                  }
-
-                  /* Create new session */
-                  u32 index = create_session(P_PLUS);
-                  session = get_latency_session(index);
-
-                  /* Save key for reverse lookup */
-                  session->key = kv.as_u64;
-                  session->plus->cat = plus0->CAT;
-
-                  /* Initialize values */
-                  session->init_src_port = udp0->src_port;
-                  session->init_src_ip = ip0->src_address.as_u32;
-                  session->new_dst_ip = new_dst_ip;
-                  update_state(&kv, session->index);
-
-                  /* Packets in reverse direction will get same session
-                   * Necessary because we rewrite the IPs */
-                  make_plus_key(&kv, 0, new_dst_ip, udp0->src_port,
-                           udp0->dst_port, ip0->protocol,
-                           plus0->CAT);
-
-                  update_state(&kv, session->index);
-                  
-                  session->key_reverse = kv.as_u64;
-                  
-                  session->pkt_count = 1;
-
-                  start_timer(session, TIMEOUT);
-                }
-
-                /* Do PLUS PSN PSE RTT estimation */
-                update_plus_rtt_estimate(vm, session->plus, vlib_time_now (vm),
-                              udp0->src_port, session->init_src_port,
-                              clib_net_to_host_u32(plus0->PSN),
-                              clib_net_to_host_u32(plus0->PSE),
-                              clib_net_to_host_u64(plus0->CAT),
-                              session->pkt_count);
-
-                /* Handle extended header */
-                plus_ext_hop_c_h_t *plus_ext_hop_c0;
-                
-                /* Enough space for extended header */
-                if ((plus0->magic_and_flags & EXTENDED) && b0->current_length
-                     >= SIZE_PLUS + SIZE_PLUS_EXT_HELLO) {
-                  plus_ext_hop_c0 = vlib_buffer_get_current(b0);
-                
-                  u8 ii = plus_ext_hop_c0->PCF_len_and_II & 0x03;
-                  /* "Hop count" header */
-                  if (plus_ext_hop_c0->PCF_type == 1 && ii == 0) {
-                    plus_ext_hop_c0->PCF_hop_c += 1;
-                  }
-                }
-                
-              }
-            }
-          }
-        } else {
-          /* TCP spin and TS */
-          if (ip0->protocol == TCP_PROTOCOL && b0->current_length >= SIZE_TCP) {
-                
-            /* Get TCP header */
-            tcp0 = vlib_buffer_get_current(b0);
-            vlib_buffer_advance (b0, SIZE_TCP);
-            total_advance += SIZE_TCP;
-            is_udp = false;
-
-            /* For timestamp values */
-            u32 tsval = 0;
-            u32 tsecr = 0;
-
-            int parse_ret = tcp_options_parse_mod(tcp0, &tsval, &tsecr);
-
-            if (parse_ret) {
-              goto skip_packet;
-            }
+  /* Next node is the ip4-lookup node, error-drop in passive mode */
+  .next_nodes = {
+    [IP4_LOOKUP] = "ip4-lookup",
+    [LATENCY_NEXT_DROP] = "error-drop",
+  },
+};
 
-            /* Ignore SYN ACK packets, no VEC  */
-            if (PREDICT_FALSE(tcp_syn(tcp0) && tcp_ack(tcp0))) {
-              make_measurement = false;             
-            }
+VLIB_REGISTER_NODE (latency_tcp_node) = {
+  .function = latency_tcp_node_fn,
+  .name = "latency-tcp",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
 
-            /* VEC data from reserved space */
-            u8 measurement = (tcp0->data_offset_and_reserved & TCP_LATENCY_MASK)
-                    >> TCP_LATENCY_SHIFT;
-
-            latency_key_t kv;
-            make_key(&kv, ip0->src_address.as_u32, ip0->dst_address.as_u32,
-                     tcp0->src_port, tcp0->dst_port, ip0->protocol);
-
-            session = get_session_from_key(&kv);
-
-            /* Only first packet in a flow should not have a session */
-            if (PREDICT_FALSE(!session)) {
-
-              /* Only consider flows for known dst (dst port) */
-              u32 new_dst_ip;
-              get_new_dst(&new_dst_ip, tcp0->dst_port);
-              if (!new_dst_ip) {
-                goto skip_packet;
-              }
-
-              /* Create new session */
-              u32 index = create_session(P_TCP);
-              session = get_latency_session(index);
-
-              /* Save key for reverse lookup */
-              session->key = kv.as_u64;
-
-              /* Initialize values */
-              session->init_src_port = tcp0->src_port;
-              session->init_src_ip = ip0->src_address.as_u32;
-              session->new_dst_ip = new_dst_ip;
-              update_state(&kv, session->index);
-
-              /* Packets in reverse direction will get same session
-               * Necessary because we rewrite the IPs */
-              make_key(&kv, 0, new_dst_ip, tcp0->src_port,
-                       tcp0->dst_port, ip0->protocol);
-              update_state(&kv, session->index);
-              
-              session->key_reverse = kv.as_u64;
-              
-              session->pkt_count = 1;
-
-              start_timer(session, TIMEOUT);
-            }
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
 
-            /* Do timestamp and latency RTT estimation */
-            if (PREDICT_TRUE(make_measurement)) {
-              update_tcp_rtt_estimate(vm, session->tcp, vlib_time_now (vm),
-                        tcp0->src_port, session->init_src_port, measurement,
-                        tsval, tsecr, session->pkt_count,
-                        clib_net_to_host_u32(tcp0->seq_number));
-            }
-          }
-        }
+  .n_next_nodes = LATENCY_N_NEXT,
 
-        if (!session) {
-          goto skip_packet;
-        }
+  .next_nodes = {
+    [IP4_LOOKUP] = "ip4-lookup",
+    [LATENCY_NEXT_DROP] = "error-drop",
+  },
+};
 
-        /* Keep track of packets for each flow */
-        session->pkt_count ++;
+VLIB_REGISTER_NODE (latency_plus_node) = {
+  .function = latency_plus_node_fn,
+  .name = "latency-plus",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
 
-        /* NAT-like IP translation */
-        if (!ip_nat_translation(ip0, session->init_src_ip, session->new_dst_ip)) {
-          goto skip_packet;
-        }
-        
-        /* Update UDP and IP checksum */
-        if (is_udp) {
-          udp0->checksum = 0;
-          udp0->checksum = ip4_tcp_udp_compute_checksum (vm, b0, ip0);
-        } else {
-          tcp0->checksum = 0;
-          tcp0->checksum = ip4_tcp_udp_compute_checksum (vm, b0, ip0); 
-        }
-        ip0->checksum = ip4_header_checksum (ip0);
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
 
-        /* Currently only ACTIVE and ERROR state
-         * The timer is just used to free memory if flow is no longer observed
-         * PLUS states not implemented at the moment */
-        switch ((latency_state_t) session->state) {
-          case LATENCY_STATE_ACTIVE:
-            update_timer(session, TIMEOUT);
-          break;
+  .n_next_nodes = LATENCY_N_NEXT,
 
-          case LATENCY_STATE_ERROR:
-          break;
+  .next_nodes = {
+    [IP4_LOOKUP] = "ip4-lookup",
+    [LATENCY_NEXT_DROP] = "error-drop",
+  },
+};
 
-          default:
-          break;
-        }
+VLIB_REGISTER_NODE (latency_ip6_quic_node) = {
+  .function = latency_ip6_quic_node_fn,
+  .name = "latency-ip6-quic",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
 
-        /* If packet trace is active */
-        if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE) 
-            && (b0->flags & VLIB_BUFFER_IS_TRACED))) {
-          
-          latency_trace_t *t = vlib_add_trace (vm, node, b0, sizeof (*t));
-          if (is_udp) {
-            t->src_port = clib_net_to_host_u16(udp0->src_port);
-            t->dst_port = clib_net_to_host_u16(udp0->dst_port);
-          } else {
-            t->src_port = clib_net_to_host_u16(tcp0->src_port);
-            t->dst_port = clib_net_to_host_u16(tcp0->dst_port);
-          }
-          t->new_src_ip = clib_net_to_host_u32(ip0->src_address.as_u32);
-          t->new_dst_ip = clib_net_to_host_u32(ip0->dst_address.as_u32);
-          t->type = session->p_type;
-          t->pkt_count = session->pkt_count;
-        }
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
 
-        /* Move buffer pointer back such that next node gets expected position */
-skip_packet:
-        vlib_buffer_advance (b0, -total_advance);
+  .n_next_nodes = LATENCY_IP6_N_NEXT,
+
+  /* Next node is the ip6-lookup node, error-drop in passive mode */
+  .next_nodes = {
+    [IP6_LOOKUP] = "ip6-lookup",
+    [LATENCY_IP6_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_REGISTER_NODE (latency_ip6_tcp_node) = {
+  .function = latency_ip6_tcp_node_fn,
+  .name = "latency-ip6-tcp",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
+
+  .n_next_nodes = LATENCY_IP6_N_NEXT,
+
+  .next_nodes = {
+    [IP6_LOOKUP] = "ip6-lookup",
+    [LATENCY_IP6_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_REGISTER_NODE (latency_ip6_plus_node) = {
+  .function = latency_ip6_plus_node_fn,
+  .name = "latency-ip6-plus",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
+
+  .n_next_nodes = LATENCY_IP6_N_NEXT,
+
+  .next_nodes = {
+    [IP6_LOOKUP] = "ip6-lookup",
+    [LATENCY_IP6_NEXT_DROP] = "error-drop",
+  },
+};
+
+/* Variants for the CPU march types of VPP (e.g. AVX2), the best one for
+ * the running CPU is selected at startup */
+#define _(n,p,is_ip6) \
+VLIB_NODE_FUNCTION_MULTIARCH (latency_##n##_node, latency_##n##_node_fn)
+foreach_latency_proto_node
+#undef _
+
+/* Used to display the classifier decision in the packet trace */
+typedef struct {
+  u32 next_index;
+} latency_classify_trace_t;
+
+/* packet trace format function */
+static u8 * format_latency_classify_trace (u8 * s, va_list * args) {
+  /* Ignore two first arguments */
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+
+  latency_classify_trace_t * t = va_arg (*args, latency_classify_trace_t *);
+
+  const char * nextNames[] = {
+#define _(sym,str) str,
+    foreach_latency_classify_next
+#undef _
+  };
+
+  s = format (s, "LATENCY classify: next %s", nextNames[t->next_index]);
+
+  return s;
+}
+
+/* Packets classified at once, one vector lane per packet. A generic GCC
+ * vector is lowered to two SSE operations in the default variant of the
+ * node and to a single AVX2 operation in its AVX2 variant */
+#define LATENCY_CLASSIFY_BLOCK 8
+typedef u32 latency_u32x8 __attribute__ ((vector_size (32)));
+
+/**
+ * @brief sort a block of packets to the protocol nodes
+ *
+ * Same checks as latency_parse_packet, the protocol node does the full
+ * parsing and the buffers are not advanced. The header fields of all
+ * packets of the block are gathered first, the length, protocol and PLUS
+ * magic checks are then done on all lanes at once. Like the scalar path,
+ * the gather only loads the IP header, ports and magic which are within
+ * current_length. QUIC and NAT ports are single bit tests in the port
+ * bitmaps.
+ *
+ * In forwarding mode only flows towards a NAT port are tracked, packets
+ * with neither port in the NAT ports skip the protocol nodes.
+ */
+always_inline void
+latency_classify_block (vlib_main_t * vm, u32 * bi, u32 * next, u32 n,
+                        int is_ip6, u8 passive, u32 * counts) {
+  u32 l3_size;
+  /* Bytes after the L3 header(s) */
+  u32 len[LATENCY_CLASSIFY_BLOCK] __attribute__ ((aligned (32)));
+  u32 protocol[LATENCY_CLASSIFY_BLOCK] __attribute__ ((aligned (32)));
+  u32 magic[LATENCY_CLASSIFY_BLOCK] __attribute__ ((aligned (32)));
+  u32 is_udp[LATENCY_CLASSIFY_BLOCK] __attribute__ ((aligned (32)));
+  u32 is_tcp[LATENCY_CLASSIFY_BLOCK] __attribute__ ((aligned (32)));
+  u32 is_plus[LATENCY_CLASSIFY_BLOCK] __attribute__ ((aligned (32)));
+  u16 src_port[LATENCY_CLASSIFY_BLOCK];
+  u16 dst_port[LATENCY_CLASSIFY_BLOCK];
+  u8 ip6_skipped[LATENCY_CLASSIFY_BLOCK];
+  u32 i;
+
+  /* Gather, unused lanes fail the length checks */
+  for (i = 0; i < LATENCY_CLASSIFY_BLOCK; i++) {
+    if (i >= n) {
+      len[i] = 0;
+      protocol[i] = 0;
+      magic[i] = 0;
+      continue;
+    }
+
+    vlib_buffer_t * b0 = vlib_get_buffer (vm, bi[i]);
+    u8 * data = vlib_buffer_get_current (b0);
+
+    ip6_skipped[i] = 0;
+    if (is_ip6) {
+      if (PREDICT_TRUE(b0->current_length >= SIZE_IP6)) {
+        l3_size = latency_ip6_l4_offset (data, b0->current_length,
+                                         &protocol[i]);
+      } else {
+        /* No L4 protocol, counted as truncated by the protocol node */
+        l3_size = SIZE_IP6;
+        protocol[i] = ~0;
       }
-      
-      /* verify speculative enqueue, maybe switch current next frame */
-      vlib_validate_buffer_enqueue_x1 (vm, node, next_index, to_next,
-                                       n_left_to_next, bi0, next0);
+    } else if (PREDICT_TRUE(b0->current_length >= SIZE_IP4)) {
+      ip4_header_t * ip0 = (ip4_header_t *) data;
+      /* IPv6 packets are handled by the latency-ip6 node */
+      ip6_skipped[i] = (ip0->ip_version_and_header_length & 0xF0) == 0x60;
+      protocol[i] = ip6_skipped[i] ? 0 : ip0->protocol;
+      l3_size = SIZE_IP4;
+    } else {
+      l3_size = SIZE_IP4;
+      protocol[i] = ~0;
+    }
+    len[i] = b0->current_length > l3_size ? b0->current_length - l3_size : 0;
+
+    /* TCP has the ports at the same offset as UDP */
+    udp_header_t * udp0 = (udp_header_t *) (data + l3_size);
+    plus_header_t * plus0 = (plus_header_t *) (udp0 + 1);
+
+    /* Checked before the loads, lanes too short for the ports or the PLUS
+     * header fail the length checks below and get zeroes */
+    src_port[i] = 0;
+    dst_port[i] = 0;
+    magic[i] = 0;
+    if (PREDICT_TRUE(len[i] >= SIZE_UDP)) {
+      src_port[i] = udp0->src_port;
+      dst_port[i] = udp0->dst_port;
+    }
+    if (len[i] >= SIZE_UDP + SIZE_PLUS) {
+      magic[i] = plus0->magic_and_flags;
     }
+  }
 
-    vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+  {
+#define splat(v) { v, v, v, v, v, v, v, v }
+    latency_u32x8 udp_v = splat(UDP_PROTOCOL);
+    latency_u32x8 tcp_v = splat(TCP_PROTOCOL);
+    latency_u32x8 mask_v = splat(MAGIC_MASK);
+    latency_u32x8 magic_v = splat(MAGIC);
+    latency_u32x8 min_udp_v = splat(SIZE_UDP);
+    latency_u32x8 min_plus_v = splat(SIZE_UDP + SIZE_PLUS);
+    latency_u32x8 min_tcp_v = splat(SIZE_TCP);
+#undef splat
+    latency_u32x8 l = *(latency_u32x8 *) len;
+    latency_u32x8 p = *(latency_u32x8 *) protocol;
+    latency_u32x8 m = *(latency_u32x8 *) magic;
+    latency_u32x8 udp = (latency_u32x8) (p == udp_v)
+                        & (latency_u32x8) (l >= min_udp_v);
+
+    *(latency_u32x8 *) is_udp = udp;
+    *(latency_u32x8 *) is_plus = udp & (latency_u32x8) (l >= min_plus_v)
+                                 & (latency_u32x8) ((m & mask_v) == magic_v);
+    *(latency_u32x8 *) is_tcp = (latency_u32x8) (p == tcp_v)
+                                & (latency_u32x8) (l >= min_tcp_v);
+  }
+
+  for (i = 0; i < n; i++) {
+    u32 next0 = LATENCY_CLASSIFY_NEXT_LOOKUP;
+
+    if ((is_udp[i] || is_tcp[i])
+        && (passive || is_nat_port(src_port[i], dst_port[i]))) {
+      if (is_udp[i] && is_quic(src_port[i], dst_port[i])) {
+        next0 = LATENCY_CLASSIFY_NEXT_QUIC;
+      } else if (is_plus[i]) {
+        next0 = LATENCY_CLASSIFY_NEXT_PLUS;
+      } else if (is_tcp[i]) {
+        next0 = LATENCY_CLASSIFY_NEXT_TCP;
+      }
+    } else if (PREDICT_FALSE(ip6_skipped[i])) {
+      counts[LATENCY_ERROR_IP6_SKIPPED]++;
+    } else if (PREDICT_FALSE(is_ip6 && latency_ip6_is_ext(protocol[i]))) {
+      counts[LATENCY_ERROR_IP6_NO_L4]++;
+    } else if (PREDICT_FALSE((protocol[i] == UDP_PROTOCOL && !is_udp[i])
+                             || (protocol[i] == TCP_PROTOCOL && !is_tcp[i]))) {
+      counts[LATENCY_ERROR_SHORT_HEADER]++;
+    }
+
+    if (passive && next0 == LATENCY_CLASSIFY_NEXT_LOOKUP) {
+      next0 = LATENCY_CLASSIFY_NEXT_DROP;
+    }
+    next[i] = next0;
+  }
+}
+
+/**
+ * @brief enqueue a list of buffers to one next node
+ */
+always_inline void
+latency_enqueue_list (vlib_main_t * vm, vlib_node_runtime_t * node,
+                      u32 next_index, u32 * bi, u32 n) {
+  u32 * to_next, n_left_to_next, n_copy;
+
+  while (n > 0) {
+    vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+    n_copy = clib_min (n, n_left_to_next);
+    clib_memcpy (to_next, bi, n_copy * sizeof (u32));
+    bi += n_copy;
+    n -= n_copy;
+
+    vlib_put_next_frame (vm, node, next_index, n_left_to_next - n_copy);
+  }
+}
+
+/**
+ * @brief Classifier loop, the entry point of the IPv4 and IPv6 feature
+ *
+ * Sorts the packets of a frame by protocol into one index list per next
+ * node, every list is then enqueued as a whole. Each protocol node thus
+ * processes a homogeneous batch. Untracked packets go to the lookup node,
+ * or are dropped in passive mode.
+ */
+always_inline uword
+latency_classify_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
+                         vlib_frame_t * frame, int is_ip6) {
+  u32 * from = vlib_frame_vector_args (frame);
+  u32 n_left_from = frame->n_vectors;
+  latency_per_thread_t * ptd = get_per_thread (vm->thread_index);
+  u32 * next = ptd->classify_next;
+  u32 (* lists)[VLIB_FRAME_SIZE] = ptd->classify_lists;
+  u32 n_list[LATENCY_CLASSIFY_N_NEXT] = { 0 };
+  u32 counts[LATENCY_N_ERROR] = { 0 };
+  u8 passive = latency_main.passive;
+  u32 i, j;
+
+  /* Classify block by block, prefetching the headers of the next block */
+  for (i = 0; i < n_left_from; i += LATENCY_CLASSIFY_BLOCK) {
+    u32 n = clib_min (LATENCY_CLASSIFY_BLOCK, n_left_from - i);
+    u32 n_prefetch = clib_min (i + 2 * LATENCY_CLASSIFY_BLOCK, n_left_from);
+
+    for (j = i + LATENCY_CLASSIFY_BLOCK; j < n_prefetch; j++) {
+      vlib_buffer_t * p = vlib_get_buffer (vm, from[j]);
+      vlib_prefetch_buffer_header (p, LOAD);
+      /* IPv6, UDP and PLUS header may span two cache lines */
+      CLIB_PREFETCH (p->data, (is_ip6 ? 2 : 1) * CLIB_CACHE_LINE_BYTES, LOAD);
+    }
+
+    latency_classify_block (vm, from + i, next + i, n, is_ip6, passive,
+                            counts);
   }
 
+  for (i = 0; i < n_left_from; i++) {
+    lists[next[i]][n_list[next[i]]++] = from[i];
+  }
+
+  if (passive) {
+    for (i = 0; i < n_list[LATENCY_CLASSIFY_NEXT_DROP]; i++) {
+      vlib_buffer_t * b0 =
+        vlib_get_buffer (vm, lists[LATENCY_CLASSIFY_NEXT_DROP][i]);
+      b0->error = node->errors[LATENCY_ERROR_PASSIVE];
+    }
+  }
+
+  /* If packet trace is active */
+  if (PREDICT_FALSE(node->flags & VLIB_NODE_FLAG_TRACE)) {
+    for (i = 0; i < n_left_from; i++) {
+      vlib_buffer_t * b0 = vlib_get_buffer (vm, from[i]);
+      if (b0->flags & VLIB_BUFFER_IS_TRACED) {
+        latency_classify_trace_t *t = vlib_add_trace (vm, node, b0,
+                                                      sizeof (*t));
+        t->next_index = next[i];
+      }
+    }
+  }
+
+  for (i = 0; i < LATENCY_CLASSIFY_N_NEXT; i++) {
+    latency_enqueue_list (vm, node, i, lists[i], n_list[i]);
+  }
+
+  latency_count_errors (vm, node, counts);
+
   return frame->n_vectors;
 }
 
+static uword
+latency_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+                 vlib_frame_t * frame) {
+  return latency_classify_inline (vm, node, frame, 0 /* is_ip6 */);
+}
+
+static uword
+latency_ip6_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+                     vlib_frame_t * frame) {
+  return latency_classify_inline (vm, node, frame, 1 /* is_ip6 */);
+}
 
 VLIB_REGISTER_NODE (latency_node) = {
   .function = latency_node_fn,
   .name = "latency",
   .vector_size = sizeof (u32),
-  .format_trace = format_latency_trace,
+  .format_trace = format_latency_classify_trace,
   .type = VLIB_NODE_TYPE_INTERNAL,
-  
+
   .n_errors = ARRAY_LEN(latency_error_strings),
   .error_strings = latency_error_strings,
 
-  .n_next_nodes = LATENCY_N_NEXT,
+  .n_next_nodes = LATENCY_CLASSIFY_N_NEXT,
 
-  /* Next node is the ip4-lookup node */
   .next_nodes = {
-    [IP4_LOOKUP] = "ip4-lookup",
+    [LATENCY_CLASSIFY_NEXT_LOOKUP] = "ip4-lookup",
+    [LATENCY_CLASSIFY_NEXT_DROP] = "error-drop",
+    [LATENCY_CLASSIFY_NEXT_QUIC] = "latency-quic",
+    [LATENCY_CLASSIFY_NEXT_TCP] = "latency-tcp",
+    [LATENCY_CLASSIFY_NEXT_PLUS] = "latency-plus",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (latency_node, latency_node_fn)
+
+VLIB_REGISTER_NODE (latency_ip6_node) = {
+  .function = latency_ip6_node_fn,
+  .name = "latency-ip6",
+  .vector_size = sizeof (u32),
+  .format_trace = format_latency_classify_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
+
+  .n_next_nodes = LATENCY_CLASSIFY_N_NEXT,
+
+  .next_nodes = {
+    [LATENCY_CLASSIFY_NEXT_LOOKUP] = "ip6-lookup",
+    [LATENCY_CLASSIFY_NEXT_DROP] = "error-drop",
+    [LATENCY_CLASSIFY_NEXT_QUIC] = "latency-ip6-quic",
+    [LATENCY_CLASSIFY_NEXT_TCP] = "latency-ip6-tcp",
+    [LATENCY_CLASSIFY_NEXT_PLUS] = "latency-ip6-plus",
   },
 };
+
+VLIB_NODE_FUNCTION_MULTIARCH (latency_ip6_node, latency_ip6_node_fn)
+
+/**
+ * @brief Advance the timer wheel of the calling thread
+ *
+ * Interrupt driven input node, woken up by the housekeeping process.
+ * Runs on the thread that owns the timer wheel so the session teardown
+ * never races with the packet loop.
+ */
+static uword
+latency_expire_node_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+                        vlib_frame_t * frame) {
+  latency_per_thread_t * ptd = get_per_thread(vlib_get_thread_index ());
+
+  ptd->n_expired = 0;
+  expire_timers(ptd, vlib_time_now (vm));
+  if (ptd->n_expired) {
+    vlib_node_increment_counter (vm, node->node_index,
+                                 LATENCY_ERROR_SESSION_EXPIRED,
+                                 ptd->n_expired);
+  }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (latency_expire_node) = {
+  .function = latency_expire_node_fn,
+  .name = "latency-expire",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_INTERRUPT,
+
+  .n_errors = ARRAY_LEN(latency_error_strings),
+  .error_strings = latency_error_strings,
+};
+
+/**
+ * @brief Housekeeping process
+ *
+ * Every housekeeping interval: signal the threads running the latency
+ * node to advance their timer wheel and update the time in the shared
+ * memory stats. The output is written by the latency-output process.
+ */
+static uword
+latency_housekeeping_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+                              vlib_frame_t * f) {
+  latency_main_t * pm = &latency_main;
+  uword * event_data = 0;
+  u32 i;
+
+  while (1) {
+    /* A LATENCY_EVENT_INTERVAL event only restarts the wait */
+    vlib_process_wait_for_event_or_clock (vm, pm->housekeeping_interval);
+    vlib_process_get_events (vm, &event_data);
+    vec_reset_length (event_data);
+
+    /* Without workers the latency node runs on the main thread */
+    for (i = vlib_num_workers () ? 1 : 0; i < vec_len (vlib_mains); i++) {
+      vlib_node_set_interrupt_pending (vlib_mains[i],
+                                       latency_expire_node.index);
+    }
+
+    latency_stats_set_time(latency_time_now_us (vm));
+  }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (latency_housekeeping_node) = {
+  .function = latency_housekeeping_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "latency-housekeeping",
+};
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * @brief Latency plugin, asynchronous RTT output.
+ *
+ * The packet path only fills fixed size records into a ring of its thread
+ * (latency_record_get() in latency.h). The latency-output process drains
+ * the rings of all threads, formats the CSV lines and writes each output
+ * file in one batch. If the writer falls behind, records are dropped and
+ * counted ("output records dropped") instead of stalling the packet path.
+ *
+ * In binary output mode the records are appended to the memory mapped
+ * segments of the binary RTT log (latency_log.h) instead, without any
+ * formatting.
+ *
+ * Flow summaries (summary output mode) always go to their own CSV file,
+ * one line per estimator and direction.
+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vnet/vnet.h>
+#include <latency/latency.h>
+
+/* Host column of the CSV output, indexed by LATENCY_DIR_* */
+static char * latency_dir_names[] = {"client", "server"};
+
+/* Protocol and number of estimators of each output */
+static u8 latency_output_p_type[LATENCY_N_OUTPUT] = {
+  [LATENCY_OUTPUT_QUIC] = P_QUIC,
+  [LATENCY_OUTPUT_TCP] = P_TCP,
+  [LATENCY_OUTPUT_PLUS] = P_PLUS,
+};
+static u8 latency_output_n_rtt[LATENCY_N_OUTPUT] = {
+  [LATENCY_OUTPUT_QUIC] = 4,
+  [LATENCY_OUTPUT_TCP] = 4,
+  [LATENCY_OUTPUT_PLUS] = 1,
+};
+
+/* Protocol and estimator columns of the summary output */
+static char * latency_output_names[LATENCY_N_OUTPUT] = {
+  [LATENCY_OUTPUT_QUIC] = "quic",
+  [LATENCY_OUTPUT_TCP] = "tcp",
+  [LATENCY_OUTPUT_PLUS] = "plus",
+};
+static char * latency_estimator_names[LATENCY_N_OUTPUT][LATENCY_STATS_N_ESTIMATORS] = {
+  [LATENCY_OUTPUT_QUIC] = {"spin", "pn_spin", "vec", "heur"},
+  [LATENCY_OUTPUT_TCP] = {"vec", "single_ts_rtt", "all_ts_rtt", "vec_ne_zero"},
+  [LATENCY_OUTPUT_PLUS] = {"psn_pse"},
+};
+
+/**
+ * @brief allocate the output rings and open the output files
+ */
+clib_error_t * latency_output_init (vlib_main_t * vm) {
+  latency_main_t * pm = &latency_main;
+  latency_per_thread_t * ptd;
+  latency_ring_t * r;
+
+  vec_foreach (ptd, pm->per_thread) {
+    r = clib_mem_alloc_aligned (sizeof (*r), CLIB_CACHE_LINE_BYTES);
+    memset (r, 0, sizeof (*r));
+    r->size = pm->ring_size;
+    r->records = clib_mem_alloc_aligned (r->size * sizeof (latency_record_t),
+                                         CLIB_CACHE_LINE_BYTES);
+    ptd->ring = r;
+  }
+
+  /* Open output files up front, they are shared by all threads */
+#define _(sym,path) \
+  pm->output[LATENCY_OUTPUT_##sym] = fopen (path, "w"); \
+  if (!pm->output[LATENCY_OUTPUT_##sym]) \
+    clib_unix_warning ("fopen %s", path);
+  foreach_latency_output
+#undef _
+
+  /* Summaries come from all protocols, their header is only written once */
+  if (pm->output[LATENCY_OUTPUT_SUMMARY]) {
+    fputs ("flow_id,protocol,host,estimator,start,duration,samples,"
+           "min,mean,max,p50,p99\n", pm->output[LATENCY_OUTPUT_SUMMARY]);
+    fflush (pm->output[LATENCY_OUTPUT_SUMMARY]);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief format one record as CSV line
+ */
+static u8 * format_latency_record (u8 * s, va_list * args) {
+  latency_record_t * rec = va_arg (*args, latency_record_t *);
+  f64 time = latency_us_to_s (rec->time);
+  char * host = latency_dir_names[rec->dir];
+  u32 n_rtt, i;
+
+  switch (rec->output) {
+    case LATENCY_OUTPUT_QUIC:
+      if (rec->is_header) {
+        return format (s, "%s\n", "time,pn,host,spin_data,spin_new,"
+                       "pn_spin_data,pn_spin_new,vec_data,vec_new,"
+                       "heur_data,heur_new");
+      }
+      s = format (s, "%.*lf,%u,%s", TIME_PRECISION, time, rec->seq, host);
+      break;
+
+    case LATENCY_OUTPUT_TCP:
+      if (rec->is_header) {
+        return format (s, "%s\n", "time,host,seq_num,vec_data,vec_new,"
+                       "single_ts_rtt_data,single_ts_rtt_new,"
+                       "all_ts_rtt_data,all_ts_rtt_new,"
+                       "vec_ne_zero_data,vec_ne_zero_new");
+      }
+      s = format (s, "%.*lf,%s,%u", TIME_PRECISION, time, host, rec->seq);
+      break;
+
+    case LATENCY_OUTPUT_PLUS:
+      if (rec->is_header) {
+        return format (s, "%s\n", "time,host,#pkt,psn,pse,cat,"
+                       "psn_pse_data,psn_pse_new");
+      }
+      s = format (s, "%.*lf,%s,%u,%u,%u,%llu", TIME_PRECISION, time, host,
+                  rec->seq, rec->psn, rec->pse, rec->cat);
+      break;
+
+    default:
+      return s;
+  }
+
+  n_rtt = latency_output_n_rtt[rec->output];
+  for (i = 0; i < n_rtt; i++) {
+    s = format (s, ",%.*lf,%d", RTT_PRECISION, latency_us_to_s (rec->rtt[i]),
+                (rec->new_rtt >> i) & 1);
+  }
+  return format (s, "\n");
+}
+
+/**
+ * @brief format a flow summary record as CSV line
+ */
+static u8 * format_latency_summary (u8 * s, va_list * args) {
+  latency_record_t * rec = va_arg (*args, latency_record_t *);
+  char * estimator = latency_estimator_names[rec->output][rec->estimator];
+
+  return format (s, "%llu,%s,%s,%s,%.*lf,%.*lf,%u,%.*lf,%.*lf,%.*lf,"
+                 "%.*lf,%.*lf\n", rec->flow_id,
+                 latency_output_names[rec->output],
+                 latency_dir_names[rec->dir], estimator ? estimator : "",
+                 TIME_PRECISION, latency_us_to_s (rec->time),
+                 TIME_PRECISION, latency_us_to_s (rec->duration),
+                 rec->n_samples,
+                 RTT_PRECISION, latency_us_to_s (rec->rtt_min),
+                 RTT_PRECISION, latency_us_to_s (rec->rtt_mean),
+                 RTT_PRECISION, latency_us_to_s (rec->rtt_max),
+                 RTT_PRECISION, latency_us_to_s (rec->rtt_p50),
+                 RTT_PRECISION, latency_us_to_s (rec->rtt_p99));
+}
+
+/**
+ * @brief unmap the current segment of the binary log
+ */
+static void latency_log_close (void) {
+  latency_main_t * pm = &latency_main;
+
+  if (pm->log) {
+    munmap (pm->log, pm->log_segment_size);
+    pm->log = 0;
+  }
+}
+
+/**
+ * @brief create and map the next segment of the binary log
+ *
+ * The segment is fully allocated up front, appending a record is a plain
+ * memory write.
+ */
+static int latency_log_open (void) {
+  latency_main_t * pm = &latency_main;
+  latency_log_header_t * h;
+  uword size = pm->log_segment_size;
+  u8 * path;
+  void * base;
+  int fd, rv;
+
+  latency_log_close ();
+
+  path = format (0, LATENCY_LOG_PATH_FORMAT "%c", pm->log_segment, 0);
+  fd = open ((char *) path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    clib_unix_warning ("open %s", path);
+    goto fail;
+  }
+
+  rv = posix_fallocate (fd, 0, size);
+  if (rv) {
+    errno = rv;
+    clib_unix_warning ("posix_fallocate %s", path);
+    close (fd);
+    goto fail;
+  }
+
+  base = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED) {
+    clib_unix_warning ("mmap %s", path);
+    goto fail;
+  }
+
+  h = base;
+  h->magic = LATENCY_LOG_MAGIC;
+  h->version = LATENCY_LOG_VERSION;
+  h->record_size = sizeof (latency_log_record_t);
+  h->capacity = (size - sizeof (*h)) / sizeof (latency_log_record_t);
+  h->n_records = 0;
+
+  pm->log = h;
+  pm->log_segment++;
+  vec_free (path);
+  return 0;
+
+fail:
+  pm->log_failed = 1;
+  vec_free (path);
+  return -1;
+}
+
+/**
+ * @brief append one log record per estimator of an output record
+ */
+static void latency_log_append (latency_record_t * rec) {
+  latency_main_t * pm = &latency_main;
+  latency_log_record_t * l;
+  u32 n_rtt = latency_output_n_rtt[rec->output];
+  u64 n;
+  u32 i;
+
+  for (i = 0; i < n_rtt; i++) {
+    if (!pm->log || pm->log->n_records == pm->log->capacity) {
+      if (pm->log_failed || latency_log_open ()) {
+        return;
+      }
+    }
+
+    n = pm->log->n_records;
+    l = (latency_log_record_t *) (pm->log + 1) + n;
+    l->flow_id = rec->flow_id;
+    l->time = rec->time;
+    l->rtt = rec->rtt[i];
+    l->seq = rec->seq;
+    l->p_type = latency_output_p_type[rec->output];
+    l->estimator = i;
+    l->dir = rec->dir;
+    l->flags = (rec->new_rtt >> i) & 1 ? LATENCY_LOG_FLAG_NEW : 0;
+    l->pad = 0;
+
+    /* Readers of a segment in use only look at complete records */
+    __atomic_store_n (&pm->log->n_records, n + 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief format or log the records of a ring, returns the number of
+ * records
+ */
+static u32 latency_output_drain_ring (latency_ring_t * r) {
+  latency_main_t * pm = &latency_main;
+  latency_record_t * rec;
+  u32 tail = r->tail;
+  u32 head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+  u32 n = head - tail;
+
+  for (; tail != head; tail++) {
+    rec = &r->records[tail & (r->size - 1)];
+    if (rec->output >= LATENCY_N_OUTPUT) {
+      continue;
+    }
+    if (rec->is_summary) {
+      pm->output_buf[LATENCY_OUTPUT_SUMMARY] =
+        format (pm->output_buf[LATENCY_OUTPUT_SUMMARY], "%U",
+                format_latency_summary, rec);
+    } else if (pm->output_mode == LATENCY_OUTPUT_MODE_BINARY) {
+      /* The log has no header lines */
+      if (!rec->is_header) {
+        latency_log_append (rec);
+      }
+    } else {
+      pm->output_buf[rec->output] =
+        format (pm->output_buf[rec->output], "%U", format_latency_record, rec);
+    }
+  }
+
+  /* Hand the records back to the producer */
+  __atomic_store_n (&r->tail, tail, __ATOMIC_RELEASE);
+  return n;
+}
+
+/**
+ * @brief drain all rings and write the output files in one go each
+ */
+static void latency_output_flush (void) {
+  latency_main_t * pm = &latency_main;
+  latency_per_thread_t * ptd;
+  u32 n = 0;
+  int i;
+
+  vec_foreach (ptd, pm->per_thread) {
+    if (ptd->ring) {
+      n += latency_output_drain_ring (ptd->ring);
+    }
+  }
+  if (!n) {
+    return;
+  }
+
+  for (i = 0; i < LATENCY_N_OUTPUT; i++) {
+    if (vec_len (pm->output_buf[i]) && pm->output[i]) {
+      fwrite (pm->output_buf[i], 1, vec_len (pm->output_buf[i]),
+              pm->output[i]);
+      fflush (pm->output[i]);
+    }
+    vec_reset_length (pm->output_buf[i]);
+  }
+}
+
+/**
+ * @brief Output writer process
+ *
+ * Runs on the main thread, such that the file I/O never blocks a worker.
+ */
+static uword
+latency_output_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+                        vlib_frame_t * f) {
+  while (1) {
+    vlib_process_suspend (vm, LATENCY_OUTPUT_INTERVAL);
+    latency_output_flush ();
+  }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (latency_output_node, static) = {
+  .function = latency_output_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "latency-output",
+};
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * @brief Latency plugin, spin bit estimators.
+ *
+ * A spin edge yields the time since the previous edge of the same
+ * direction. The first edge of a flow has no previous one, it only starts
+ * the first period and yields no sample.
+ *
+ * Kept apart from the plugin setup such that the tests can link them
+ * without vlib (see test_spin.c).
+ */
+
+#include <latency/spin.h>
+
+/**
+ * BASIC latency estimator
+ */
+bool basic_latency_estimate(struct vlib_main_t * vm,
+        basic_spin_observer_t *observer, u64 now, u8 dir, bool spin) {
+  bool update = false;
+
+  if (observer->spin[dir] != spin) {
+    observer->spin[dir] = spin;
+    /* The first edge only starts the first period */
+    if (observer->time_last_spin[dir]) {
+      observer->rtt[dir] = latency_rtt_us(now, observer->time_last_spin[dir]);
+      observer->new_rtt[dir] = true;
+      update = true;
+    }
+    observer->time_last_spin[dir] = now;
+  }
+  return update;
+}
+
+/*
+ * (PN) observer
+ */
+//TODO this does not handle PN wrap around yet
+bool pn_latency_estimate(struct vlib_main_t * vm,
+        pn_spin_observer_t *observer, u64 now, u8 dir, bool spin,
+        u32 packet_number) {
+  bool update = false;
+
+  /* check if arrived in order and has different spin */
+  if (packet_number > observer->pn[dir] && observer->spin[dir] != spin) {
+    observer->spin[dir] = spin;
+    observer->pn[dir] = packet_number;
+    /* The first edge only starts the first period */
+    if (observer->time_last_spin[dir]) {
+      observer->rtt[dir] = latency_rtt_us(now, observer->time_last_spin[dir]);
+      observer->new_rtt[dir] = true;
+      update = true;
+    }
+    observer->time_last_spin[dir] = now;
+  }
+  return update;
+}
+
+/*
+ * VEC observer
+ */
+bool status_estimate(struct vlib_main_t * vm,
+        status_spin_observer_t *observer, u64 now, u8 dir, bool spin,
+        u8 status) {
+  bool update = false;
+  /* check if arrived in order and has different spin */
+  if (observer->spin[dir] != spin) {
+    observer->spin[dir] = spin;
+    /* only report and store RTT if it was valid over the entire round trip,
+     * and there was a previous edge */
+    if (status == STATUS_VALID && observer->time_last_spin[dir]){
+      observer->rtt[dir] = latency_rtt_us(now, observer->time_last_spin[dir]);
+      observer->new_rtt[dir] = true;
+      update = true;
+    }
+  }
+  if (status != STATUS_INVALID) observer->time_last_spin[dir] = now;
+  return update;
+}
+
+/*
+ * VEC ne zero estimate
+ */
+bool vec_ne_zero_estimate(struct vlib_main_t * vm,
+        status_spin_observer_t *observer, u64 now, u8 dir, bool spin,
+        u8 status) {
+  bool update = false;
+  /* check if arrived in order and has different spin */
+  if (observer->spin[dir] != spin) {
+    observer->spin[dir] = spin;
+    /* only report and store RTT if it was valid over the entire round trip,
+     * and there was a previous edge */
+    if (status != STATUS_INVALID && observer->time_last_spin[dir]){
+      observer->rtt[dir] = latency_rtt_us(now, observer->time_last_spin[dir]);
+      observer->new_rtt[dir] = true;
+      update = true;
+    }
+  }
+  if (status != STATUS_INVALID) observer->time_last_spin[dir] = now;
+  return update;
+}
+
+/*
+ * Dynamic heuristic observer
+ */
+bool heuristic_estimate(struct vlib_main_t * vm,
+        dyna_heur_spin_observer_t *observer, u64 now, u8 dir, bool spin) {
+  bool update = false;
+  u32 * history = observer->rtt[dir];
+
+  if (observer->spin[dir] != spin) {
+    observer->spin[dir] = spin;
+    /* The first edge only starts the first period */
+    if (!observer->time_last_spin[dir]) {
+      observer->time_last_spin[dir] = now;
+      return false;
+    }
+    u32 rtt_candidate = latency_rtt_us(now, observer->time_last_spin[dir]);
+
+    /* calculate the acceptance threshold */
+    u32 acceptance_threshold = history[0];
+    for(int i = 1; i < DYNA_HEUR_HISTORY_SIZE; i++){
+      if (history[i] < acceptance_threshold){
+        acceptance_threshold = history[i];
+      }
+    }
+    acceptance_threshold /= DYNA_HEUR_THRESHOLD_DIV;
+
+    if (rtt_candidate > acceptance_threshold ||
+        observer->rejected[dir] >= DYNA_HEUR_MAX_REJECT){
+      observer->rejected[dir] = 0;
+      observer->index[dir] =
+        (observer->index[dir] + 1) % DYNA_HEUR_HISTORY_SIZE;
+      history[observer->index[dir]] = rtt_candidate;
+      observer->new_rtt[dir] = true;
+      update = true;
+      /* The assumption is that a packet has been held back long enough to arrive
+       * after the valid spin edge, therefore, we completely ignore this false spin edge
+       * and do not report the time at which we saw this packet */
+      observer->time_last_spin[dir] = now;
+
+    /* if the rtt_candidate is rejected */
+    } else {
+      observer->rejected[dir]++;
+    }
+  }
+  return update;
+}
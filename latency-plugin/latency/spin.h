@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Spin bit estimators
+ *
+ * The observer state and the estimators of spin.c. Only needs vppinfra,
+ * such that test_spin links spin.c without vlib. The estimators do not use
+ * vm, so vlib_main_t stays incomplete here.
+ */
+
+#ifndef __included_latency_spin_h__
+#define __included_latency_spin_h__
+
+#include <stdbool.h>
+#include <vppinfra/clib.h>
+#include <vppinfra/types.h>
+
+struct vlib_main_t;
+
+#define SPIN_NOT_KNOWN 255
+
+/**
+ * @brief RTT between two times, saturated to the u32 range
+ */
+always_inline u32 latency_rtt_us(u64 now, u64 then) {
+  u64 rtt = now - then;
+  return rtt > (u32) ~0 ? (u32) ~0 : rtt;
+}
+
+/* Structs for the different spin observers
+ * All of them are indexed by the direction of the packet */
+typedef struct {
+  u8 spin[2];
+  u64 time_last_spin[2];
+  u32 rtt[2];
+  bool new_rtt[2];
+} basic_spin_observer_t;
+
+typedef struct {
+  u8 spin[2];
+  u64 time_last_spin[2];
+  u32 rtt[2];
+  u32 pn[2];
+  bool new_rtt[2];
+} pn_spin_observer_t;
+
+#define STATUS_INVALID      0b00
+#define STATUS_HANDSHAKE_1  0b01
+#define STATUS_HANDSHAKE_2  0b10
+#define STATUS_VALID        0b11
+typedef struct {
+  u8 spin[2];
+  u64 time_last_spin[2];
+  u32 rtt[2];
+  bool new_rtt[2];
+} status_spin_observer_t;
+
+/* Acceptance threshold: a tenth of the smallest RTT of the history */
+#define DYNA_HEUR_THRESHOLD_DIV 10
+#define DYNA_HEUR_HISTORY_SIZE 10
+#define DYNA_HEUR_MAX_REJECT 5
+typedef struct {
+  u8 spin[2];
+  u64 time_last_spin[2];
+  u32 rtt[2][DYNA_HEUR_HISTORY_SIZE];
+  u8 index[2];
+  u8 rejected[2];
+  bool new_rtt[2];
+} dyna_heur_spin_observer_t;
+
+bool basic_latency_estimate(struct vlib_main_t * vm,
+        basic_spin_observer_t *observer, u64 now, u8 dir, bool spin);
+bool pn_latency_estimate(struct vlib_main_t * vm,
+        pn_spin_observer_t *observer, u64 now, u8 dir, bool spin,
+        u32 packet_number);
+bool status_estimate(struct vlib_main_t * vm,
+        status_spin_observer_t *observer, u64 now, u8 dir, bool spin,
+        u8 status);
+bool vec_ne_zero_estimate(struct vlib_main_t * vm,
+        status_spin_observer_t *observer, u64 now, u8 dir, bool spin,
+        u8 status);
+bool heuristic_estimate(struct vlib_main_t * vm,
+        dyna_heur_spin_observer_t *observer, u64 now, u8 dir, bool spin);
+
+#endif /* __included_latency_spin_h__ */
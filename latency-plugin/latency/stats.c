@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * @brief Latency plugin, per flow RTT gauges in shared memory.
+ *
+ * VPP 17.10 has no stats segment plugins can register gauges in, so the
+ * plugin maps its own POSIX shared memory object. The layout is described
+ * in latency_stats.h. Each thread only writes its own block of slots, the
+ * per packet update is done by latency_stats_update() in latency.h.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vnet/vnet.h>
+#include <latency/latency.h>
+
+/**
+ * @brief create and map the shared memory object
+ *
+ * Failing to do so is not fatal, the flows are just not exported.
+ */
+void latency_stats_init (vlib_main_t * vm) {
+  latency_main_t * pm = &latency_main;
+  latency_per_thread_t * ptd;
+  latency_stats_header_t * h;
+  u32 n_threads = vec_len (pm->per_thread);
+  u32 n_slots = pm->max_sessions;
+  uword size;
+  void * base;
+  int fd;
+
+  size = sizeof (latency_stats_header_t)
+         + (uword) n_threads * n_slots * sizeof (latency_stats_slot_t);
+
+  /* Start over, a collector may still map an old object */
+  shm_unlink (LATENCY_STATS_SHM_NAME);
+  fd = shm_open (LATENCY_STATS_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    clib_unix_warning ("shm_open %s", LATENCY_STATS_SHM_NAME);
+    return;
+  }
+
+  /* Zero filled, i.e. all slots unused with an even sequence number */
+  if (ftruncate (fd, size) < 0) {
+    clib_unix_warning ("ftruncate %s", LATENCY_STATS_SHM_NAME);
+    close (fd);
+    shm_unlink (LATENCY_STATS_SHM_NAME);
+    return;
+  }
+
+  base = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED) {
+    clib_unix_warning ("mmap %s", LATENCY_STATS_SHM_NAME);
+    shm_unlink (LATENCY_STATS_SHM_NAME);
+    return;
+  }
+
+  h = base;
+  h->version = LATENCY_STATS_VERSION;
+  h->n_threads = n_threads;
+  h->slots_per_thread = n_slots;
+  h->slot_size = sizeof (latency_stats_slot_t);
+  h->now = latency_time_now_us (vm);
+
+  vec_foreach (ptd, pm->per_thread) {
+    ptd->stats_slots = (latency_stats_slot_t *) (h + 1)
+                       + (uword) (ptd - pm->per_thread) * n_slots;
+  }
+
+  pm->stats = h;
+  pm->stats_size = size;
+  pm->stats_slots_per_thread = n_slots;
+
+  /* The magic tells collectors that the header is complete */
+  __atomic_store_n (&h->magic, LATENCY_STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief claim the slot of a new session and publish its flow key
+ */
+void latency_stats_session_open (latency_per_thread_t * ptd,
+                latency_session_t * session, u64 now) {
+  latency_stats_slot_t * slot = latency_stats_slot (ptd, session);
+  latency_session_cold_t * cold;
+
+  if (!slot) {
+    return;
+  }
+
+  cold = get_latency_session_cold (ptd, session);
+  latency_stats_begin (slot);
+  slot->p_type = session->p_type;
+  slot->is_ip6 = session->is_ip6;
+  memset (slot->ip_lo, 0, sizeof (slot->ip_lo));
+  memset (slot->ip_hi, 0, sizeof (slot->ip_hi));
+  if (session->is_ip6) {
+    clib_memcpy (slot->ip_lo, &cold->key6.ip_lo, sizeof (ip6_address_t));
+    clib_memcpy (slot->ip_hi, &cold->key6.ip_hi, sizeof (ip6_address_t));
+    slot->port_lo = cold->key6.port_lo;
+    slot->port_hi = cold->key6.port_hi;
+    slot->protocol = cold->key6.protocol;
+  } else {
+    clib_memcpy (slot->ip_lo, &cold->key.ip_lo, sizeof (u32));
+    clib_memcpy (slot->ip_hi, &cold->key.ip_hi, sizeof (u32));
+    slot->port_lo = cold->key.port_lo;
+    slot->port_hi = cold->key.port_hi;
+    slot->protocol = cold->key.protocol;
+  }
+  slot->pkt_count = session->pkt_count;
+  slot->start_time = now;
+  slot->last_time = now;
+  memset (slot->rtt_us, 0, sizeof (slot->rtt_us));
+  slot->in_use = 1;
+  latency_stats_end (slot);
+}
+
+/**
+ * @brief release the slot of a session which is cleaned up
+ */
+void latency_stats_session_close (latency_per_thread_t * ptd,
+                latency_session_t * session) {
+  latency_stats_slot_t * slot = latency_stats_slot (ptd, session);
+
+  if (!slot) {
+    return;
+  }
+
+  latency_stats_begin (slot);
+  slot->in_use = 0;
+  latency_stats_end (slot);
+}
+
+/**
+ * @brief publish the current time, for the flow age (housekeeping process)
+ */
+void latency_stats_set_time (u64 now) {
+  if (latency_main.stats) {
+    latency_main.stats->now = now;
+  }
+}
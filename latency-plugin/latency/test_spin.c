@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2015 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ *------------------------------------------------------------------
+ * test_spin.c - spin bit estimator test
+ *
+ * Feeds each estimator of spin.c the spin edges of one direction of a
+ * flow. The first edge of the flow only starts the first period: it must
+ * not yield a sample. The next edges yield the time since the previous
+ * one. Run by make check.
+ *------------------------------------------------------------------
+ */
+
+#include <vppinfra/format.h>
+#include <vppinfra/mem.h>
+#include <vppinfra/string.h>
+#include <latency/spin.h>
+
+/* Time of the first packet and the RTT, in us */
+#define T0 5000000
+#define RTT 20000
+#define DIR 0 /* LATENCY_DIR_CLIENT */
+
+static int n_failed;
+
+#define SPIN_TEST(cond)                                           \
+do {                                                              \
+  if (!(cond)) {                                                  \
+    fformat (stderr, "%s:%d: %s failed\n", __FILE__, __LINE__,    \
+             #cond);                                              \
+    n_failed++;                                                   \
+  }                                                               \
+} while (0)
+
+static void test_basic (void) {
+  basic_spin_observer_t o;
+
+  memset (&o, 0, sizeof (o));
+  o.spin[DIR] = SPIN_NOT_KNOWN;
+  SPIN_TEST (!basic_latency_estimate (0, &o, T0, DIR, 0));
+  SPIN_TEST (!o.new_rtt[DIR] && o.rtt[DIR] == 0);
+  SPIN_TEST (!basic_latency_estimate (0, &o, T0 + RTT / 2, DIR, 0));
+  SPIN_TEST (basic_latency_estimate (0, &o, T0 + RTT, DIR, 1));
+  SPIN_TEST (o.new_rtt[DIR] && o.rtt[DIR] == RTT);
+}
+
+static void test_pn (void) {
+  pn_spin_observer_t o;
+
+  memset (&o, 0, sizeof (o));
+  o.spin[DIR] = SPIN_NOT_KNOWN;
+  SPIN_TEST (!pn_latency_estimate (0, &o, T0, DIR, 0, 1));
+  SPIN_TEST (!o.new_rtt[DIR] && o.rtt[DIR] == 0);
+  SPIN_TEST (pn_latency_estimate (0, &o, T0 + RTT, DIR, 1, 2));
+  SPIN_TEST (o.new_rtt[DIR] && o.rtt[DIR] == RTT);
+}
+
+static void test_status (void) {
+  status_spin_observer_t o;
+
+  memset (&o, 0, sizeof (o));
+  o.spin[DIR] = SPIN_NOT_KNOWN;
+  SPIN_TEST (!status_estimate (0, &o, T0, DIR, 0, STATUS_VALID));
+  SPIN_TEST (!o.new_rtt[DIR] && o.rtt[DIR] == 0);
+  SPIN_TEST (status_estimate (0, &o, T0 + RTT, DIR, 1, STATUS_VALID));
+  SPIN_TEST (o.new_rtt[DIR] && o.rtt[DIR] == RTT);
+}
+
+static void test_vec_ne_zero (void) {
+  status_spin_observer_t o;
+
+  memset (&o, 0, sizeof (o));
+  o.spin[DIR] = SPIN_NOT_KNOWN;
+  SPIN_TEST (!vec_ne_zero_estimate (0, &o, T0, DIR, 0, STATUS_VALID));
+  SPIN_TEST (!o.new_rtt[DIR] && o.rtt[DIR] == 0);
+  SPIN_TEST (vec_ne_zero_estimate (0, &o, T0 + RTT, DIR, 1, STATUS_VALID));
+  SPIN_TEST (o.new_rtt[DIR] && o.rtt[DIR] == RTT);
+}
+
+static void test_heuristic (void) {
+  dyna_heur_spin_observer_t o;
+  u32 i;
+
+  memset (&o, 0, sizeof (o));
+  o.spin[DIR] = SPIN_NOT_KNOWN;
+  SPIN_TEST (!heuristic_estimate (0, &o, T0, DIR, 0));
+  SPIN_TEST (!o.new_rtt[DIR]);
+  for (i = 0; i < DYNA_HEUR_HISTORY_SIZE; i++) {
+    SPIN_TEST (o.rtt[DIR][i] == 0);
+  }
+  SPIN_TEST (heuristic_estimate (0, &o, T0 + RTT, DIR, 1));
+  SPIN_TEST (o.new_rtt[DIR] && o.rtt[DIR][o.index[DIR]] == RTT);
+}
+
+int main (int argc, char * argv[]) {
+  clib_mem_init (0, 64 << 20);
+
+  test_basic ();
+  test_pn ();
+  test_status ();
+  test_vec_ne_zero ();
+  test_heuristic ();
+
+  if (n_failed) {
+    fformat (stderr, "%d checks failed\n", n_failed);
+    return 1;
+  }
+  fformat (stdout, "spin estimators: ok\n");
+  return 0;
+}
@@ -0,0 +1,98 @@
+#!/bin/bash
+
+# Clocks/packet of the latency nodes, measured with the VPP packet generator
+#
+# Usage: bench_runtime.sh [<git revision> ...]
+#
+# Without a revision, the installed plugin is measured. Otherwise each
+# revision is built and installed (like build.sh) and measured in turn, e.g.
+# to compare the single loop latency node with the dual loop one:
+#   sudo ./bench_runtime.sh b895d57 08d6fb6
+#
+# The plugin runs in its forward (NAT) mode, which every revision has, on
+# a packet generator interface, no NIC is needed. The traffic is QUIC
+# (short header, spin bit and VEC set) from FLOWS client addresses to the
+# MB address, PACKETS packets in total. The plugin creates a session per
+# client and rewrites the packets towards the server, which is reached
+# through a second packet generator interface that discards them. Prints
+# one line per latency node and revision: revision, node, vectors,
+# clocks/packet.
+
+FLOWS=${FLOWS:-10000}
+PACKETS=${PACKETS:-10000000}
+PKT_SIZE=${PKT_SIZE:-64}
+REPO=${REPO:-/home/vagrant/vpp-latency-mb}
+
+set -e
+
+MB_IP=10.0.0.254
+SERVER_IP=10.1.0.1
+
+# Client addresses 10.0.1.0 and up, one flow each, next to the MB in
+# 10.0.0.0/16 (up to 65000 flows)
+last_client() {
+  local n=$(($1 - 1))
+  echo "10.0.$((1 + n / 256)).$((n % 256))"
+}
+
+measure() {
+  local rev=$1
+  local cfg=$(mktemp)
+
+  service vpp restart
+  sleep 5
+
+  cat > $cfg <<EOF
+create packet-generator interface pg0
+set interface ip address pg0 $MB_IP/16
+set interface state pg0 up
+create packet-generator interface pg1
+set interface ip address pg1 10.1.0.254/16
+set interface state pg1 up
+set ip arp pg1 $SERVER_IP 02:00:00:00:01:01
+latency mb_ip $MB_IP
+latency nat $SERVER_IP 4433
+latency quic_port 4433
+latency interface pg0
+packet-generator new {
+  name quic
+  limit $PACKETS
+  node ip4-input
+  size $PKT_SIZE-$PKT_SIZE
+  interface pg0
+  data {
+    UDP: 10.0.1.0 - $(last_client $FLOWS) -> $MB_IP
+    UDP: 4433 -> 4433
+    hex 0x01014c
+  }
+}
+EOF
+  vppctl exec $cfg
+  rm -f $cfg
+
+  vppctl clear runtime
+  vppctl packet-generator enable-stream quic
+  # The stream disables itself once the limit is reached
+  while vppctl show packet-generator | grep -q "quic.*Yes"; do
+    sleep 1
+  done
+
+  # Name State Calls Vectors Suspends Clocks Vectors/Call
+  vppctl show runtime | awk -v rev=$rev \
+    '$1 ~ /^latency/ && $4 > 0 { print rev, $1, $4, $6 }'
+}
+
+if [ $# -eq 0 ]; then
+  measure installed
+  exit 0
+fi
+
+for rev in "$@"; do
+  dir=$(mktemp -d)
+  (cd $REPO; git archive $rev latency-plugin) | tar -x -C $dir
+  service vpp stop
+  (cd $dir/latency-plugin; autoreconf -fis; ./configure; make; make install) \
+    > $dir/build.log 2>&1
+  measure $rev
+  rm -rf $dir
+done